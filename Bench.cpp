@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Bench.h"
+#include "dsp.h"
+#include "Engine.h"
+#include "Graph.h"
+#include "Module.h"
+#include "Resampler.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+const int Bench::blockSizes[] = { 32, 128, 512, MAX_BLOCK_SIZE };
+const int Bench::graphSizes[] = { 1, 10, 100, 1000 };
+const int Bench::runs = 5;
+const long Bench::samplesPerRun = 1 << 18;
+
+// Time stamp counter ticks, which track nominal rather than boosted core cycles
+static uint64_t cycles() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+struct Measure {
+	double ns, cycles;
+};
+
+// Best of several runs of a block callback, per processed sample
+static Measure measure(int block, long samples, std::function<void(int)> process) {
+	for (long done = 0; done < samples; done += block)
+		process(block);
+
+	Measure best{ INFINITY, INFINITY };
+	for (int r = 0; r < Bench::runs; r++) {
+		auto start = std::chrono::steady_clock::now();
+		uint64_t c = cycles();
+		for (long done = 0; done < samples; done += block)
+			process(block);
+		c = cycles() - c;
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+		best.ns = std::min(best.ns, elapsed.count() / samples);
+		best.cycles = std::min(best.cycles, (double)c / samples);
+	}
+	return best;
+}
+
+static void connect(Output* output, Input* input) {
+	Cable* cable = new Cable(0, 0, SDL_Color{});
+	cable->start->plug(output->socket);
+	cable->end->plug(input->socket);
+}
+
+static const struct {
+	const char* name;
+	Module* (*create)();
+} modules[] = {
+	{ "VCO", []() -> Module* { return new WaveGenerator(0, 0); } },
+	{ "Mixer", []() -> Module* { return new Mixer(0, 0); } },
+	{ "BitCrusher", []() -> Module* { return new BitCrusher(0, 0); } },
+	{ "ADSR", []() -> Module* { return new ADSR(0, 0); } },
+	{ "Delay", []() -> Module* { return new Delay(0, 0); } },
+	{ "Scope", []() -> Module* { return new Scope(0, 0); } },
+};
+
+void Bench::run(std::ostream& out) {
+	out << "kind,name,nodes,block,ns_per_sample,cycles_per_sample" << std::endl;
+
+	auto row = [&](const char* kind, const char* name, int nodes, int block, Measure m) {
+		out << kind << "," << name << "," << nodes << "," << block << "," << m.ns << "," << m.cycles << std::endl;
+	};
+
+	// A slow sine, so triggers and modulated parameters keep changing
+	static float signal[MAX_BLOCK_SIZE];
+	for (int i = 0; i < MAX_BLOCK_SIZE; i++)
+		signal[i] = std::sin(2 * M_PI * i / MAX_BLOCK_SIZE);
+
+	for (auto& type : modules) {
+		Module* m = type.create();
+
+		for (int block : blockSizes) {
+			for (Input* in : m->inputs)
+				in->source = nullptr;
+			row("module", type.name, 1, block, measure(block, samplesPerRun, [m](int n) { m->process(n); }));
+		}
+
+		for (int block : blockSizes) {
+			for (Input* in : m->inputs)
+				in->source = signal;
+			row("module-modulated", type.name, 1, block, measure(block, samplesPerRun, [m](int n) { m->process(n); }));
+		}
+	}
+
+	// Every voice held, to compare with as many VCO and ADSR modules
+	Poly* poly = new Poly(0, 0);
+	for (int v = 0; v < Poly::voiceCount; v++)
+		poly->noteOn(48 + v);
+	for (int block : blockSizes)
+		row("voices", "Poly", Poly::voiceCount, block, measure(block, samplesPerRun, [poly](int n) { poly->process(n); }));
+
+	// Graph output converted to common device rates, per output sample
+	for (int rate : { 44100, 96000 }) {
+		Resampler* resampler = new Resampler(sampleRate, rate);
+		std::string name = std::to_string(sampleRate) + "-" + std::to_string(rate);
+		for (int block : blockSizes) {
+			float out[MAX_BLOCK_SIZE];
+			row("resampler", name.c_str(), 1, block, measure(block, samplesPerRun, [&](int n) {
+				int needed = resampler->needed(n);
+				std::fill_n(resampler->input(needed), needed, 0.5f);
+				resampler->process(out, n);
+			}));
+		}
+		delete resampler;
+	}
+
+	// Chains of mixers with a VCO every fourth node and modulation from earlier nodes
+	for (int nodes : graphSizes) {
+		Player* player = new Player(0, 0);
+		std::vector<Module*> graph;
+
+		// Seeded the same for every run, so the rows stay comparable
+		std::minstd_rand random(nodes);
+
+		for (int i = 0; i < nodes; i++) {
+			Module* m;
+			if (i % 4 == 0) {
+				m = new WaveGenerator(0, 0);
+			} else {
+				m = new Mixer(0, 0);
+				connect(graph[i - 1]->outputs[0], m->inputs[0]);
+				connect(graph[random() % i]->outputs[0], m->inputs[1]);
+			}
+			graph.push_back(m);
+		}
+		connect(graph.back()->outputs[0], player->input);
+
+		graph.push_back(player);
+
+		Engine engine(player);
+		engine.startWorkers();
+		engine.post(PatchCommand{ PatchCommand::SetGraph, Graph::compile(graph) });
+
+		float buffer[MAX_BLOCK_SIZE];
+		long samples = std::max<long>(samplesPerRun / nodes, 8 * MAX_BLOCK_SIZE);
+		for (int block : blockSizes)
+			row("graph", "chain", nodes, block, measure(block, samples, [&](int n) { engine.process(buffer, n); }));
+	}
+}
+
+bool Bench::check(std::ostream& out) {
+	bool ok = true;
+	auto report = [&](const char* name, double error, double bound) {
+		out << name << ": max relative error " << error << " (bound " << bound << ")" << std::endl;
+		ok = ok && error < bound;
+	};
+
+	// The whole exponent range in blocks, so both the vector body and the scalar tail are covered
+	const int points = 1 << 20;
+	const int block = 61;
+	std::vector<float> x(points), y(points);
+	for (int i = 0; i < points; i++)
+		x[i] = -126 + 252.0 * i / points;
+	for (int i = 0; i < points; i += block)
+		fastExp2(&x[i], &y[i], std::min(block, points - i));
+
+	double vector = 0, scalar = 0;
+	for (int i = 0; i < points; i++) {
+		double exact = std::exp2((double)x[i]);
+		vector = std::max(vector, std::abs(y[i] - exact) / exact);
+		scalar = std::max(scalar, std::abs(fastExp2(x[i]) - exact) / exact);
+	}
+	report("fastExp2", vector, 3e-7);
+	report("fastExp2 scalar", scalar, 3e-7);
+
+	// Filter rows as the resampler uses them, relative to the sum of the absolute terms
+	double dot = 0;
+	float a[Resampler::taps + 3], b[Resampler::taps + 3], s[Resampler::taps + 3];
+	for (int trial = 0; trial < 1000; trial++) {
+		int n = Resampler::taps + trial % 4;
+		float t = (trial % 97) / 97.f;
+		for (int i = 0; i < n; i++) {
+			a[i] = std::sin(trial + i * 0.37);
+			b[i] = std::cos(trial * 0.5 + i * 0.11);
+			s[i] = std::sin(trial * 1.3 + i * 2.1);
+		}
+
+		double exact = 0, magnitude = 0;
+		for (int i = 0; i < n; i++) {
+			double c = a[i] + ((double)b[i] - a[i]) * t;
+			exact += s[i] * c;
+			magnitude += std::abs(s[i] * c);
+		}
+		dot = std::max(dot, std::abs(interpolatedDot(s, a, b, t, n) - exact) / magnitude);
+	}
+	report("interpolatedDot", dot, 1e-6);
+
+	// From the lower Nyquist frequency up, where aliases and images come from, relative to the DC gain
+	for (auto [in, out] : { std::pair{ 48000, 44100 }, std::pair{ 44100, 48000 }, std::pair{ 96000, 44100 } }) {
+		Resampler resampler(in, out);
+		double nyquist = std::min(in, out) / 2.0;
+		double stopband = 0;
+		for (int i = 0; i <= 400; i++)
+			stopband = std::max(stopband, resampler.response(nyquist + (2.0 * in - nyquist) * i / 400));
+
+		std::string name = "resampler " + std::to_string(in) + "-" + std::to_string(out) + " stopband";
+		report(name.c_str(), stopband, 1e-4);
+	}
+
+	return ok;
+}
\ No newline at end of file
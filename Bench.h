@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ostream>
+
+// Micro-benchmarks of single modules and synthetic graphs, written as CSV
+class Bench {
+public:
+	static const int blockSizes[];
+	static const int graphSizes[];
+	static const int runs;
+	static const long samplesPerRun;
+
+	static void run(std::ostream& out);
+
+	// Sweeps the vectorized dsp functions against double precision, returns false when a bound is exceeded
+	static bool check(std::ostream& out);
+};
\ No newline at end of file
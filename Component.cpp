@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <format>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
@@ -26,10 +28,12 @@ SDL::~SDL() {
 }
 
 AudioDevice::AudioDevice(SDL_AudioSpec* audioSpec) {
-	id = SDL_OpenAudioDevice(nullptr, 0, audioSpec, audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	id = SDL_OpenAudioDevice(nullptr, 0, audioSpec, audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
 	if (id == 0)
 		throw COMPONENT_EXCEPTION("Couldn't open audio device: %s");
+}
 
+void AudioDevice::resume() {
 	SDL_PauseAudioDevice(id, SDL_FALSE);
 }
 
@@ -61,6 +65,138 @@ int Font::height() {
 	return TTF_FontHeight(ttf);
 }
 
+GlyphAtlas::GlyphAtlas(SDL_Renderer* renderer, Font* font) {
+	const int count = last - first + 1;
+
+	SDL_Surface* surfaces[count]{};
+	int cellWidth = 1, cellHeight = font->height();
+
+	for (int i = 0; i < count; i++) {
+		int advance = 0;
+		TTF_GlyphMetrics(font->ttf, first + i, nullptr, nullptr, nullptr, nullptr, &advance);
+		glyphs[i].advance = advance;
+
+		surfaces[i] = TTF_RenderGlyph_Blended(font->ttf, first + i, SDL_Color{ 0xFF, 0xFF, 0xFF, 0xFF });
+		if (surfaces[i] != nullptr)
+			cellWidth = std::max(cellWidth, surfaces[i]->w);
+	}
+
+	// One extra cell holds the white pixels
+	width = cellWidth * columns;
+	height = cellHeight * ((count + columns) / columns);
+	SDL_Surface* atlas = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (atlas == nullptr)
+		throw COMPONENT_EXCEPTION("Couldn't create glyph atlas: %s");
+
+	for (int i = 0; i < count; i++) {
+		SDL_Rect& rect = glyphs[i].rect;
+		rect = SDL_Rect{ (i % columns) * cellWidth, (i / columns) * cellHeight, 0, cellHeight };
+
+		if (surfaces[i] == nullptr) continue;
+
+		rect.w = surfaces[i]->w;
+		rect.h = std::min(surfaces[i]->h, cellHeight);
+
+		// Copy coverage as is instead of blending it onto the transparent atlas
+		SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(surfaces[i], nullptr, atlas, &rect);
+		SDL_FreeSurface(surfaces[i]);
+	}
+
+	SDL_Rect whiteCell{ (count % columns) * cellWidth, (count / columns) * cellHeight, cellWidth, cellHeight };
+	SDL_FillRect(atlas, &whiteCell, 0xFFFFFFFF);
+	white = SDL_FPoint{ (whiteCell.x + cellWidth / 2.f) / width, (whiteCell.y + cellHeight / 2.f) / height };
+
+	texture = SDL_CreateTextureFromSurface(renderer, atlas);
+	SDL_FreeSurface(atlas);
+	if (texture == nullptr)
+		throw COMPONENT_EXCEPTION("Couldn't create glyph atlas texture: %s");
+
+	SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+}
+
+GlyphAtlas::~GlyphAtlas() {
+	SDL_DestroyTexture(texture);
+}
+
+const GlyphAtlas::Glyph& GlyphAtlas::glyph(char c) {
+	return glyphs[(c < first || c > last ? '?' : c) - first];
+}
+
+int GlyphAtlas::measure(const char* text) {
+	int w = 0;
+	for (const char* c = text; *c; c++)
+		w += glyph(*c).advance;
+	return w;
+}
+
+void GlyphAtlas::render(std::vector<SDL_Vertex>& vertices, std::vector<int>& indices, int x, int y, const char* text, const SDL_Color color) {
+	float u = 1.f / width, v = 1.f / height;
+	for (const char* c = text; *c; c++) {
+		const Glyph& g = glyph(*c);
+
+		if (g.rect.w > 0) {
+			float x1 = x + g.rect.w, y1 = y + g.rect.h;
+			float u0 = g.rect.x * u, v0 = g.rect.y * v;
+			float u1 = (g.rect.x + g.rect.w) * u, v1 = (g.rect.y + g.rect.h) * v;
+
+			int base = vertices.size();
+			vertices.push_back(SDL_Vertex{ { (float)x, (float)y }, color, { u0, v0 } });
+			vertices.push_back(SDL_Vertex{ { x1, (float)y }, color, { u1, v0 } });
+			vertices.push_back(SDL_Vertex{ { x1, y1 }, color, { u1, v1 } });
+			vertices.push_back(SDL_Vertex{ { (float)x, y1 }, color, { u0, v1 } });
+
+			for (int i : { 0, 1, 2, 0, 2, 3 })
+				indices.push_back(base + i);
+		}
+
+		x += g.advance;
+	}
+}
+
+WavFile::WavFile(const char* path, int sampleRate) : file(path, std::ios::binary) {
+	if (!file)
+		throw ComponentException("Couldn't open output file");
+
+	this->sampleRate = sampleRate;
+	frames = 0;
+	writeHeader();
+}
+
+WavFile::~WavFile() {
+	file.seekp(0);
+	writeHeader();
+}
+
+void WavFile::write(const float* samples, int count) {
+	file.write(reinterpret_cast<const char*>(samples), count * sizeof(float));
+	frames += count;
+}
+
+// Mono 32-bit IEEE float, sizes are patched in once the length is known
+void WavFile::writeHeader() {
+	auto u32 = [this](uint32_t v) { file.write(reinterpret_cast<const char*>(&v), 4); };
+	auto u16 = [this](uint16_t v) { file.write(reinterpret_cast<const char*>(&v), 2); };
+
+	uint32_t dataSize = frames * sizeof(float);
+
+	file.write("RIFF", 4);
+	u32(36 + dataSize);
+	file.write("WAVE", 4);
+
+	file.write("fmt ", 4);
+	u32(16);
+	u16(3);
+	u16(1);
+	u32(sampleRate);
+	u32(sampleRate * sizeof(float));
+	u16(sizeof(float));
+	u16(32);
+
+	file.write("data", 4);
+	u32(dataSize);
+}
+
 Window::Window(const char* name, int width, int height, bool resizable) {
 	this->width = width;
 	this->height = height;
@@ -80,37 +216,82 @@ Window::~Window() {
 }
 
 Renderer::Renderer(const Window& window) {
-	sdl = SDL_CreateRenderer(window.sdl, -1, 0);
+	sdl = SDL_CreateRenderer(window.sdl, -1, SDL_RENDERER_PRESENTVSYNC);
 	if (sdl == NULL)
 		throw COMPONENT_EXCEPTION("Couldn't create renderer: %s");
 
+	SDL_DisplayMode mode;
+	bool known = SDL_GetWindowDisplayMode(window.sdl, &mode) == 0 && mode.refresh_rate > 0;
+	frameInterval = 1000 / (known ? mode.refresh_rate : 60);
+
 	font = new Font("JetBrainsMono-Regular.ttf", 12);
+	atlas = new GlyphAtlas(sdl, font);
 }
 
 Renderer::~Renderer() {
 	SDL_DestroyRenderer(sdl);
 }
 
+int Renderer::vertex(float x, float y, const SDL_Color color) {
+	vertices.push_back(SDL_Vertex{ { x, y }, color, atlas->white });
+	return vertices.size() - 1;
+}
+
+void Renderer::quad(float x1, float y1, float x2, float y2, const SDL_Color color) {
+	int i = vertex(x1, y1, color);
+	vertex(x2, y1, color);
+	vertex(x2, y2, color);
+	vertex(x1, y2, color);
+
+	for (int k : { 0, 1, 2, 0, 2, 3 })
+		indices.push_back(i + k);
+}
+
+// A line as a quad of the given width, through pixel centers and covering both end pixels
+void Renderer::segment(float x1, float y1, float x2, float y2, float width, const SDL_Color color) {
+	float dx = x2 - x1, dy = y2 - y1;
+	float length = std::sqrt(dx * dx + dy * dy);
+	if (length == 0) {
+		dx = 1;
+		length = 1;
+	}
+	dx *= 0.5f / length;
+	dy *= 0.5f / length;
+
+	float nx = -dy * width, ny = dx * width;
+	x1 += 0.5f - dx;
+	y1 += 0.5f - dy;
+	x2 += 0.5f + dx;
+	y2 += 0.5f + dy;
+
+	int i = vertex(x1 + nx, y1 + ny, color);
+	vertex(x1 - nx, y1 - ny, color);
+	vertex(x2 - nx, y2 - ny, color);
+	vertex(x2 + nx, y2 + ny, color);
+
+	for (int k : { 0, 1, 2, 0, 2, 3 })
+		indices.push_back(i + k);
+}
+
 void Renderer::fillRect(const SDL_Rect* rect, const SDL_Color color) {
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-	SDL_RenderFillRect(sdl, rect);
+	quad(rect->x, rect->y, rect->x + rect->w, rect->y + rect->h, color);
 }
 
 void Renderer::line(int x1, int y1, int x2, int y2, const SDL_Color color) {
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-	SDL_RenderDrawLine(sdl, x1, y1, x2, y2);
+	segment(x1, y1, x2, y2, 1, color);
 }
 
 void Renderer::lines(const SDL_Point* points, int count, const SDL_Color color) {
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-	SDL_RenderDrawLines(sdl, points, count);
+	for (int i = 1; i < count; i++)
+		segment(points[i - 1].x, points[i - 1].y, points[i].x, points[i].y, 1, color);
 }
 
 void Renderer::strokeRect(const SDL_Rect* rect, int weight, const SDL_Color color) {
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-
 	if (weight == 1) {
-		SDL_RenderDrawRect(sdl, rect);
+		quad(rect->x, rect->y, rect->x + rect->w, rect->y + 1, color);
+		quad(rect->x, rect->y + rect->h - 1, rect->x + rect->w, rect->y + rect->h, color);
+		quad(rect->x, rect->y, rect->x + 1, rect->y + rect->h, color);
+		quad(rect->x + rect->w - 1, rect->y, rect->x + rect->w, rect->y + rect->h, color);
 		return;
 	}
 
@@ -118,78 +299,95 @@ void Renderer::strokeRect(const SDL_Rect* rect, int weight, const SDL_Color colo
 	int W = (weight + 1) / 2;
 
 	SDL_Rect top{ rect->x - W, rect->y - W, W + rect->w + W, weight };
-	SDL_RenderFillRect(sdl, &top);
+	fillRect(&top, color);
 
 	SDL_Rect bottom{ rect->x - W, rect->y + rect->h - w, W + rect->w + W, weight };
-	SDL_RenderFillRect(sdl, &bottom);
+	fillRect(&bottom, color);
 
 	SDL_Rect left{ rect->x - W, rect->y - W, weight, W + rect->h + W };
-	SDL_RenderFillRect(sdl, &left);
+	fillRect(&left, color);
 
 	SDL_Rect right{ rect->x + rect->w - w, rect->y - W, weight, W + rect->h + W };
-	SDL_RenderFillRect(sdl, &right);
+	fillRect(&right, color);
 }
 
-void Renderer::fillCircle(int x, int y, int r, const SDL_Color color) {
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-
-	SDL_Vertex vertices[CIRCLE_POINTS + 1]{};
-	int indices[CIRCLE_POINTS * 3]{};
+static const struct UnitCircle {
+	float x[CIRCLE_POINTS], y[CIRCLE_POINTS];
 
-	vertices[0] = { { (float)x, (float)y }, color, { 0, 0 } };
+	UnitCircle() {
+		float off = 2 * M_PI / (CIRCLE_POINTS * 2);
+		for (int i = 0; i < CIRCLE_POINTS; i++) {
+			float a = 2 * M_PI * i / CIRCLE_POINTS + off;
+			x[i] = std::cos(a);
+			y[i] = std::sin(a);
+		}
+	}
+} unitCircle;
 
-	float off = 2 * M_PI / (CIRCLE_POINTS * 2);
+void Renderer::fillCircle(int x, int y, int r, const SDL_Color color) {
+	int center = vertex(x, y, color);
 
 	for (int i = 0; i < CIRCLE_POINTS; i++) {
-		float a = 2 * M_PI * i / CIRCLE_POINTS + off;
-		vertices[i + 1] = { { (float)x + SDL_cosf(a) * r, (float)y + SDL_sinf(a) * r }, color, { 0, 0 } };
+		vertex(x + unitCircle.x[i] * r, y + unitCircle.y[i] * r, color);
 
-		indices[3 * i] = 0;
-		indices[3 * i + 1] = i + 1;
-		indices[3 * i + 2] = i < CIRCLE_POINTS - 1 ? i + 2 : 1;
+		indices.push_back(center);
+		indices.push_back(center + 1 + i);
+		indices.push_back(center + 1 + (i + 1) % CIRCLE_POINTS);
 	}
-
-	SDL_RenderGeometry(sdl, nullptr, vertices, CIRCLE_POINTS + 1, indices, CIRCLE_POINTS * 3);
 }
 
 int Renderer::measureText(const char* text) {
-	int width = 0;
-	TTF_SizeText(font->ttf, text, &width, nullptr);
-	return width;
+	return atlas->measure(text);
 }
 
 void Renderer::renderText(int x, int y, const char* text, const SDL_Color color) {
-	SDL_Surface* textSurface = TTF_RenderText_Blended(font->ttf, text, color);
-	
-	if (textSurface) {
-		SDL_Texture* textTexture = SDL_CreateTextureFromSurface(sdl, textSurface);
-		SDL_RenderCopy(sdl, textTexture, NULL, new SDL_Rect{ x, y, textSurface->w, textSurface->h });
-
-		SDL_FreeSurface(textSurface);
-		SDL_DestroyTexture(textTexture);
-	}
+	atlas->render(vertices, indices, x, y, text, color);
 }
 
-void Renderer::scaledPoints(const SDL_Point* points, int count, int scale, const SDL_Color color) {
-	SDL_FPoint* scaled = (SDL_FPoint*) malloc(sizeof(SDL_FPoint) * count);
+void Renderer::triangleStrip(const SDL_FPoint* points, int count, const SDL_Color color) {
+	int first = vertices.size();
 	for (int i = 0; i < count; i++)
-		scaled[i] = SDL_FPoint(((float) points[i].x) / scale, ((float) points[i].y) / scale);
+		vertex(points[i].x, points[i].y, color);
 
-	SDL_RenderSetScale(sdl, scale, scale);
-	SDL_SetRenderDrawColor(sdl, color.r, color.g, color.b, color.a);
-	SDL_RenderDrawPointsF(sdl, scaled, count);
-	SDL_RenderSetScale(sdl, 1, 1);
+	for (int i = 2; i < count; i++) {
+		indices.push_back(first + i - 2);
+		indices.push_back(first + i - 1);
+		indices.push_back(first + i);
+	}
 }
 
-void Renderer::bezier(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4, int count, int weight, const SDL_Color color) {
-	SDL_Point* points = (SDL_Point*) malloc(sizeof(SDL_Point) * (count + 1));
-	for (int i = 0; i <= count; i++) {
-		float t = (float)i / count;
+void Renderer::bezierStrip(SDL_FPoint* strip, int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4, int count, int weight) {
+	auto point = [&](float t) {
 		float t1 = 1 - t;
-		points[i] = SDL_Point(
+		return SDL_FPoint{
 			t1 * t1 * t1 * x1 + 3 * t1 * t1 * t * x2 + 3 * t1 * t * t * x3 + t * t * t * x4,
 			t1 * t1 * t1 * y1 + 3 * t1 * t1 * t * y2 + 3 * t1 * t * t * y3 + t * t * t * y4
-		);
+		};
+	};
+
+	// Each point is pushed out on both sides along the normal of the chord through its neighbours
+	SDL_FPoint previous = point(0), current = previous;
+	for (int i = 0; i <= count; i++) {
+		SDL_FPoint next = i < count ? point((float)(i + 1) / count) : current;
+
+		float dx = next.x - previous.x, dy = next.y - previous.y;
+		float length = std::sqrt(dx * dx + dy * dy);
+		float scale = length > 0 ? weight / (2 * length) : 0;
+
+		strip[2 * i] = SDL_FPoint{ current.x - dy * scale, current.y + dx * scale };
+		strip[2 * i + 1] = SDL_FPoint{ current.x + dy * scale, current.y - dx * scale };
+
+		previous = current;
+		current = next;
 	}
-	scaledPoints(points, count, weight, color);
+}
+
+void Renderer::present() {
+	if (!indices.empty())
+		SDL_RenderGeometry(sdl, atlas->texture, vertices.data(), vertices.size(), indices.data(), indices.size());
+
+	vertices.clear();
+	indices.clear();
+
+	SDL_RenderPresent(sdl);
 }
\ No newline at end of file
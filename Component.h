@@ -1,6 +1,8 @@
 #pragma once
 
 #include <format>
+#include <fstream>
+#include <vector>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
@@ -25,8 +27,11 @@ class AudioDevice : Component {
 public:
 	SDL_AudioDeviceID id;
 
+	// Opens paused, audioSpec is updated with the rate and buffer size actually granted
 	AudioDevice(SDL_AudioSpec* audioSpec);
 	~AudioDevice();
+
+	void resume();
 };
 
 class TTF : Component {
@@ -45,6 +50,51 @@ public:
 	int height();
 };
 
+// Printable ASCII glyphs rendered once into a texture, strings are appended to a batch as quads
+class GlyphAtlas : Component {
+public:
+	static const int first = 32, last = 126;
+	static const int columns = 16;
+
+	SDL_Texture* texture;
+
+	// Texture coordinate of an opaque white cell, for untextured geometry in the same batch
+	SDL_FPoint white;
+
+	GlyphAtlas(SDL_Renderer* renderer, Font* font);
+	~GlyphAtlas();
+
+	int measure(const char* text);
+
+	void render(std::vector<SDL_Vertex>& vertices, std::vector<int>& indices, int x, int y, const char* text, const SDL_Color color);
+
+private:
+	struct Glyph {
+		SDL_Rect rect;
+		int advance;
+	};
+
+	Glyph glyphs[last - first + 1];
+	int width, height;
+
+	const Glyph& glyph(char c);
+};
+
+class WavFile : Component {
+public:
+	WavFile(const char* path, int sampleRate);
+	~WavFile();
+
+	void write(const float* samples, int count);
+
+private:
+	std::ofstream file;
+	int sampleRate;
+	uint32_t frames;
+
+	void writeHeader();
+};
+
 class Window : Component {
 public:
 	SDL_Window* sdl;
@@ -60,6 +110,10 @@ public:
 	SDL_Renderer* sdl;
 
 	Font* font;
+	GlyphAtlas* atlas;
+
+	// Milliseconds between frames at the display's refresh rate
+	int frameInterval;
 
 	Renderer(const Window& window);
 	~Renderer();
@@ -78,7 +132,21 @@ public:
 
 	void renderText(int x, int y, const char* text, const SDL_Color color);
 
-	void scaledPoints(const SDL_Point* points, int count, int scale, const SDL_Color color);
+	void triangleStrip(const SDL_FPoint* points, int count, const SDL_Color color);
+
+	// Outline of a thick cubic bezier as 2 * (count + 1) triangle strip points
+	static void bezierStrip(SDL_FPoint* strip, int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4, int count, int weight);
+
+	// Draws everything batched since the last present, in call order, then shows the frame
+	void present();
+
+private:
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+
+	int vertex(float x, float y, const SDL_Color color);
+
+	void quad(float x1, float y1, float x2, float y2, const SDL_Color color);
 
-	void bezier(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4, int count, int weight, const SDL_Color color);
+	void segment(float x1, float y1, float x2, float y2, float width, const SDL_Color color);
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <vector>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include "audioConfig.h"
+#include "Graph.h"
 #include "Module.h"
 #include "util.h"
 #include "window.h"
@@ -10,6 +12,19 @@ const SDL_Color Drawable::bgColor{ 0x20, 0x20, 0x20 };
 const SDL_Color Drawable::borderColor{ 0x40, 0x40, 0x40 };
 const SDL_Color Drawable::textColor{ 0xD0, 0xD0, 0xD0 };
 
+std::atomic<bool> Drawable::dirty{ true };
+
+// Only sets the flag, so it is safe to call from the audio thread
+void Drawable::invalidate() {
+	dirty.store(true, std::memory_order_relaxed);
+}
+
+unsigned Drawable::layoutVersion = 1;
+
+void Drawable::relayout() {
+	layoutVersion++;
+}
+
 Drawable::Drawable(int x, int y) {
 	this->x = x;
 	this->y = y;
@@ -19,14 +34,25 @@ Drawable::Drawable(int x, int y) {
 void Drawable::addChild(Drawable* child) {
 	children.push_back(child);
 	child->parent = this;
+	relayout();
 }
 
 int Drawable::getX() {
-	return parent ? x + parent->getX() : x;
+	if (layout != layoutVersion)
+		updateLayout();
+	return absX;
 }
 
 int Drawable::getY() {
-	return parent ? y + parent->getY() : y;
+	if (layout != layoutVersion)
+		updateLayout();
+	return absY;
+}
+
+void Drawable::updateLayout() {
+	absX = parent ? x + parent->getX() : x;
+	absY = parent ? y + parent->getY() : y;
+	layout = layoutVersion;
 }
 
 void Drawable::draw(Renderer& renderer) {
@@ -67,6 +93,13 @@ bool Drawable::onKeyDown(SDL_KeyboardEvent* evt) {
 	return false;
 }
 
+bool Drawable::onKeyUp(SDL_KeyboardEvent* evt) {
+	for (int i = 0; i < children.size(); i++)
+		if (children[i]->onKeyUp(evt))
+			return true;
+	return false;
+}
+
 bool Drawable::onTextInput(SDL_TextInputEvent* evt) {
 	for (int i = 0; i < children.size(); i++)
 		if (children[i]->onTextInput(evt))
@@ -106,7 +139,7 @@ void Draggable::constrain() {
 	if (x - l < mix) x = mix + l;
 
 	int r = right ? *right : 0;
-	int max = maxX ? *maxX : window.width;
+	int max = maxX ? *maxX : window->width;
 	if (x + r > max) x = max - r;
 
 	int t = top ? *top : 0;
@@ -114,8 +147,14 @@ void Draggable::constrain() {
 	if (y - t < miy) y = miy + t;
 
 	int b = bottom ? *bottom : 0;
-	int may = maxY ? *maxY : window.height;
+	int may = maxY ? *maxY : window->height;
 	if (y + b > may) y = may - b;
+
+	moved();
+}
+
+void Draggable::moved() {
+	relayout();
 }
 
 bool Draggable::onMouseMotion(SDL_MouseMotionEvent* evt) {
@@ -131,10 +170,7 @@ bool Draggable::onMouseMotion(SDL_MouseMotionEvent* evt) {
 
 const int Socket::radius = 8;
 
-std::vector<Socket*> Socket::sockets;
-
 Socket::Socket(int x, int y) : Drawable(x, y) {
-	sockets.push_back(this);
 	connector = nullptr;
 	output = nullptr;
 }
@@ -143,16 +179,6 @@ void Socket::draw(Renderer& renderer) {
 	renderer.fillCircle(getX(), getY(), radius, borderColor);
 }
 
-void Socket::remove() {
-	for (int i = sockets.size() - 1; i >= 0; i--) {
-		if (sockets[i] == this) {
-			sockets.erase(sockets.begin() + i);
-			break;
-		}
-	}
-	Drawable::remove();
-}
-
 const int Knob::radius = 15;
 const int Knob::notchSize = 3;
 
@@ -238,6 +264,8 @@ bool Button::onMouseUp(SDL_MouseButtonEvent* evt) {
 	return false;
 }
 
+const float Input::silence[MAX_BLOCK_SIZE]{};
+
 int Input::textX() { return 2; };
 int Input::textY() { return 25; };
 
@@ -263,14 +291,34 @@ void Input::draw(Renderer& renderer) {
 }
 
 float Input::getValue() {
-	if (socket != nullptr && socket->connector != nullptr && socket->connector->other->socket != nullptr) {
-		Output* output = socket->connector->other->socket->output;
-		if (output != nullptr)
-			return output->value;
-	}
+	Output* output = getSource();
+	return output != nullptr ? output->value : 0;
+}
+
+const float* Input::getBlock(int nframes) {
+	return source != nullptr ? source : silence;
+}
+
+float Input::getControl(int nframes) {
+	return source != nullptr ? source[nframes - 1] : 0;
+}
+
+float Input::getSetting() {
 	return 0;
 }
 
+void Input::setSetting(float value) {}
+
+bool Input::isConnected() {
+	return source != nullptr;
+}
+
+Output* Input::getSource() {
+	if (socket != nullptr && socket->connector != nullptr && socket->connector->other->socket != nullptr)
+		return socket->connector->other->socket->output;
+	return nullptr;
+}
+
 const int KnobInput::knobX = 20;
 const int KnobInput::knobY = 20;
 
@@ -280,17 +328,44 @@ int KnobInput::textY() { return 34; };
 KnobInput::KnobInput(const char* name, int x, int y, std::vector<float> notches) : Input(name, x, y, 60, 50, 48, 12) {
 	knob = new Knob(knobX, knobY, notches);
 	addChild(knob);
+
+	gain = knob->value;
 }
 
 float KnobInput::getValue() {
-	if (socket != nullptr && socket->connector != nullptr && socket->connector->other->socket != nullptr) {
-		Output* output = socket->connector->other->socket->output;
-		if (output != nullptr)
-			return knob->value * output->value;
+	Output* output = getSource();
+	return output != nullptr ? knob->value * output->value : knob->value;
+}
+
+// The knob is sampled once per block and ramped linearly to avoid zipper noise
+const float* KnobInput::getBlock(int nframes) {
+	float step = (knob->value - gain) / nframes;
+
+	if (source != nullptr) {
+		for (int i = 0; i < nframes; i++)
+			buffer[i] = (gain + step * (i + 1)) * source[i];
+	} else {
+		for (int i = 0; i < nframes; i++)
+			buffer[i] = gain + step * (i + 1);
 	}
+
+	gain = knob->value;
+	return buffer;
+}
+
+float KnobInput::getControl(int nframes) {
+	gain = knob->value;
+	return source != nullptr ? gain * source[nframes - 1] : gain;
+}
+
+float KnobInput::getSetting() {
 	return knob->value;
 }
 
+void KnobInput::setSetting(float value) {
+	knob->value = gain = value;
+}
+
 const int ButtonInput::buttonX = 15;
 const int ButtonInput::buttonY = 15;
 
@@ -303,20 +378,38 @@ ButtonInput::ButtonInput(const char* name, int x, int y, bool toggle) : Input(na
 }
 
 float ButtonInput::getValue() {
-	if (socket != nullptr && socket->connector != nullptr && socket->connector->other->socket != nullptr) {
-		Output* output = socket->connector->other->socket->output;
-		if (output != nullptr)
-			return output->value;
-	}
-	return button->pressed ? 1 : 0;
+	Output* output = getSource();
+	return output != nullptr ? output->value : button->pressed ? 1 : 0;
+}
+
+const float* ButtonInput::getBlock(int nframes) {
+	if (source != nullptr)
+		return source;
+
+	std::fill_n(buffer, nframes, button->pressed ? 1 : 0);
+	return buffer;
+}
+
+float ButtonInput::getControl(int nframes) {
+	return source != nullptr ? source[nframes - 1] : button->pressed ? 1 : 0;
+}
+
+// Momentary buttons are released when the patch is saved
+float ButtonInput::getSetting() {
+	return button->toggle && button->pressed ? 1 : 0;
+}
+
+void ButtonInput::setSetting(float value) {
+	button->pressed = button->toggle && value != 0;
 }
 
 const int Output::socketX = 10;
 const int Output::socketY = 10;
 
-Output::Output(const char* name, int x, int y, std::function<float()> nextValue) : Drawable(x, y) {
+Output::Output(const char* name, int x, int y, std::function<void(float*, int)> nextBlock) : Drawable(x, y) {
 	this->name = name;
-	this->nextValue = nextValue;
+	this->nextBlock = nextBlock;
+	module = nullptr;
 
 	socket = new Socket(socketX, socketY);
 	socket->output = this;
@@ -328,8 +421,11 @@ void Output::draw(Renderer& renderer) {
 	Drawable::draw(renderer);
 }
 
-void Output::step() {
-	value = nextValue();
+void Output::process(int nframes) {
+	if (!nextBlock) return;
+
+	nextBlock(buffer, nframes);
+	value = buffer[nframes - 1];
 }
 
 const int Connector::radius = 6;
@@ -358,30 +454,61 @@ bool Connector::onMouseMotion(SDL_MouseMotionEvent* evt) {
 	Draggable::onMouseMotion(evt);
 
 	if (dragging) {
-		for (Socket* s : Socket::sockets) {
-			if (pointInCircle(s->getX(), s->getY(), getX(), getY(), snapDistance)) {
-				socket = s;
-				socket->connector = this;
-				return true;
-			}
+		int cx = getX();
+		int cy = getY();
+
+		// Only the modules near the connector can own a socket within reach
+		Socket* found = nullptr;
+		SDL_Rect reach{ cx - snapDistance, cy - snapDistance, 2 * snapDistance, 2 * snapDistance };
+		Module::grid.query(reach, [&](Module* m) {
+			for (Input* i : m->inputs)
+				if (found == nullptr && pointInCircle(i->socket->getX(), i->socket->getY(), cx, cy, snapDistance))
+					found = i->socket;
+			for (Output* o : m->outputs)
+				if (found == nullptr && pointInCircle(o->socket->getX(), o->socket->getY(), cx, cy, snapDistance))
+					found = o->socket;
+		});
+
+		if (found != nullptr) {
+			if (socket != found)
+				Graph::invalidate();
+			socket = found;
+			socket->connector = this;
+			return true;
 		}
 		if (socket != nullptr) {
 			socket->connector = nullptr;
 			socket = nullptr;
+			Graph::invalidate();
 		}
 	}
 
 	return dragging;
 }
 
+void Connector::plug(Socket* s) {
+	socket = s;
+	socket->connector = this;
+	x = socket->getX();
+	y = socket->getY();
+	relayout();
+	Graph::invalidate();
+}
+
 void Connector::draw(Renderer& renderer) {
-	if (!dragging && socket) {
+	if (!dragging && socket && (x != socket->getX() || y != socket->getY())) {
 		x = socket->getX();
 		y = socket->getY();
+		relayout();
 	}
 }
 
 
+const int Cable::weight = 3;
+const int Cable::segmentLength = 8;
+const int Cable::minSegments = 8;
+const int Cable::maxSegments = 64;
+
 Cable::Cable(int x, int y, SDL_Color color) : Drawable(0, 0) {
 	this->color = color;
 
@@ -404,16 +531,29 @@ void Cable::draw(Renderer& renderer) {
 	renderer.fillCircle(sx, sy, Connector::radius, color);
 	renderer.fillCircle(ex, ey, Connector::radius, color);
 
+	if (sx != cachedStart.x || sy != cachedStart.y || ex != cachedEnd.x || ey != cachedEnd.y)
+		tessellate(sx, sy, ex, ey);
+	renderer.triangleStrip(strip.data(), strip.size(), color);
+
+	Drawable::draw(renderer);
+}
+
+void Cable::tessellate(int sx, int sy, int ex, int ey) {
+	cachedStart = SDL_Point{ sx, sy };
+	cachedEnd = SDL_Point{ ex, ey };
+
 	int off = abs(sx - ex) / 3;
-	int points = sqrt(pow(sx - ex, 2) + pow(sy - ey, 2) / 2) / 2;
-	renderer.bezier(
+	int segments = std::clamp((int)(sqrt(pow(sx - ex, 2) + pow(sy - ey, 2) / 2) / segmentLength), minSegments, maxSegments);
+
+	strip.resize(2 * (segments + 1));
+	Renderer::bezierStrip(
+		strip.data(),
 		sx, sy,
 		sx * 0.7 + ex * 0.3, sy * 0.7 + ey * 0.3 + off,
 		sx * 0.3 + ex * 0.7, sy * 0.3 + ey * 0.7 + off,
 		ex, ey,
-		points, 3, color
+		segments, weight
 	);
-	Drawable::draw(renderer);
 }
 
 bool Cable::onMouseDown(SDL_MouseButtonEvent* evt) {
@@ -421,6 +561,14 @@ bool Cable::onMouseDown(SDL_MouseButtonEvent* evt) {
 		this->start->inDragArea(evt->x, evt->y) ||
 		this->end->inDragArea(evt->x, evt->y)
 	)) {
+		for (Connector* c : { start, end }) {
+			if (c->socket != nullptr) {
+				c->socket->connector = nullptr;
+				c->socket = nullptr;
+			}
+		}
+		Graph::invalidate();
+
 		this->queueDelete = true;
 		return true;
 	}
@@ -489,6 +637,8 @@ const int EditText::padding = 2;
 const int EditText::height = 20;
 const int EditText::doubleClickDelay = 300;
 
+EditText* EditText::focused = nullptr;
+
 EditText::EditText(int x, int y, int width, const char* text) : Drawable(x, y) {
 	this->width = width;
 	this->text = std::string(text);
@@ -522,6 +672,7 @@ bool EditText::onMouseDown(SDL_MouseButtonEvent* evt) {
 			return true;
 		} else if ((clickTime > 0 && clickTime + doubleClickDelay > t)) {
 			editing = true;
+			focused = this;
 			clickTime = 0;
 			SDL_StartTextInput();
 			cursor = text.size();
@@ -533,6 +684,8 @@ bool EditText::onMouseDown(SDL_MouseButtonEvent* evt) {
 	}
 	SDL_StopTextInput();
 	editing = false;
+	if (focused == this)
+		focused = nullptr;
 	clickTime = 0;
 	return false;
 }
@@ -553,6 +706,7 @@ bool EditText::onKeyDown(SDL_KeyboardEvent* evt) {
 		else if (code == SDLK_RETURN) {
 			SDL_StopTextInput();
 			editing = false;
+			focused = nullptr;
 		}
 	}
 
@@ -1,13 +1,24 @@
 #pragma once
 
+#include <atomic>
+#include <climits>
 #include <vector>
 #include <functional>
+#include "audioConfig.h"
 #include "Component.h"
 
 class Drawable {
 public:
 	static const SDL_Color bgColor, borderColor, textColor;
 
+	// Set when the scene needs to be drawn again, also from the audio thread
+	static std::atomic<bool> dirty;
+
+	static void invalidate();
+
+	// Must be called after changing a position, so cached absolute positions are recomputed
+	static void relayout();
+
 	int x, y;
 	bool queueDelete;
 
@@ -27,12 +38,21 @@ public:
 	virtual bool onMouseMotion(SDL_MouseMotionEvent* evt);
 
 	virtual bool onKeyDown(SDL_KeyboardEvent* evt);
+	virtual bool onKeyUp(SDL_KeyboardEvent* evt);
 
 	virtual bool onTextInput(SDL_TextInputEvent* evt);
 
 protected:
 	Drawable* parent = nullptr;
 	std::vector<Drawable*> children;
+
+private:
+	static unsigned layoutVersion;
+
+	int absX, absY;
+	unsigned layout = 0;
+
+	void updateLayout();
 };
 
 class Draggable : public Drawable {
@@ -46,6 +66,9 @@ public:
 
 	void constrain();
 
+	// Called after the position changed
+	virtual void moved();
+
 	virtual bool onMouseDown(SDL_MouseButtonEvent* evt);
 	virtual bool onMouseUp(SDL_MouseButtonEvent* evt);
 	virtual bool onMouseMotion(SDL_MouseMotionEvent* evt);
@@ -63,16 +86,12 @@ class Socket : public Drawable {
 public:
 	static const int radius;
 
-	static std::vector<Socket*> sockets;
-
 	Connector* connector;
 	Output* output;
 
 	Socket(int x, int y);
 
 	virtual void draw(Renderer& renderer);
-
-	virtual void remove();
 };
 
 class Knob : public Draggable {
@@ -120,6 +139,7 @@ public:
 	int width, height;
 
 	Socket* socket;
+	const float* source = nullptr;
 
 	Input(const char* name, int x, int y, int width, int height);
 
@@ -127,7 +147,23 @@ public:
 
 	virtual float getValue();
 
+	virtual const float* getBlock(int nframes);
+
+	virtual float getControl(int nframes);
+
+	// The user-set value saved with patches
+	virtual float getSetting();
+	virtual void setSetting(float value);
+
+	bool isConnected();
+
+	Output* getSource();
+
 protected:
+	static const float silence[MAX_BLOCK_SIZE];
+
+	float buffer[MAX_BLOCK_SIZE];
+
 	Input(const char* name, int x, int y, int width, int height, int socketX, int socketY);
 
 private:
@@ -141,12 +177,21 @@ public:
 	virtual int textX();
 	virtual int textY();
 
+	Knob* knob;
+
 	KnobInput(const char* name, int x, int y, std::vector<float> notches = { -1, 0, 1 });
 
 	virtual float getValue();
 
+	virtual const float* getBlock(int nframes);
+
+	virtual float getControl(int nframes);
+
+	virtual float getSetting();
+	virtual void setSetting(float value);
+
 private:
-	Knob* knob;
+	float gain;
 };
 
 class ButtonInput : public Input {
@@ -160,6 +205,13 @@ public:
 
 	virtual float getValue();
 
+	virtual const float* getBlock(int nframes);
+
+	virtual float getControl(int nframes);
+
+	virtual float getSetting();
+	virtual void setSetting(float value);
+
 private:
 	Button* button;
 };
@@ -170,17 +222,19 @@ class Output : public Drawable {
 public:
 	static const int socketX, socketY;
 
-	std::function<float()> nextValue;
+	std::function<void(float*, int)> nextBlock;
 
 	Socket* socket;
+	Module* module;
 
 	float value = 0;
+	float buffer[MAX_BLOCK_SIZE]{};
 
-	Output(const char* name, int x, int y, std::function<float()> nextValue);
+	Output(const char* name, int x, int y, std::function<void(float*, int)> nextBlock = nullptr);
 
 	virtual void draw(Renderer& renderer);
 
-	void step();
+	void process(int nframes);
 
 private:
 	const char* name;
@@ -203,11 +257,16 @@ public:
 
 	virtual bool onMouseMotion(SDL_MouseMotionEvent* evt);
 
+	void plug(Socket* s);
+
 	Connector* other;
 };
 
 class Cable : public Drawable {
 public:
+	static const int weight;
+	static const int segmentLength, minSegments, maxSegments;
+
 	Cable(int x, int y, SDL_Color color);
 
 	Connector* start;
@@ -217,8 +276,14 @@ public:
 
 	virtual bool onMouseDown(SDL_MouseButtonEvent* evt);
 
-private:
 	SDL_Color color;
+
+private:
+	// Tessellated curve, rebuilt only when an end moves
+	std::vector<SDL_FPoint> strip;
+	SDL_Point cachedStart{ INT_MIN, INT_MIN }, cachedEnd{ INT_MIN, INT_MIN };
+
+	void tessellate(int sx, int sy, int ex, int ey);
 };
 
 class MenuOption {
@@ -256,6 +321,9 @@ public:
 	static const int height;
 	static const int doubleClickDelay;
 
+	// The text being edited, which has to hear every click to know when to stop
+	static EditText* focused;
+
 	std::string text;
 	long clickTime;
 
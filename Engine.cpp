@@ -0,0 +1,103 @@
+#include <algorithm>
+#include "Engine.h"
+
+Engine::Engine(Player* player) {
+	this->player = player;
+	player->meter = &meter;
+}
+
+Engine::~Engine() {
+	collect();
+
+	PatchCommand command;
+	while (commands.pop(command))
+		if (command.type == PatchCommand::SetGraph)
+			delete command.graph;
+
+	delete graph;
+	delete resampler;
+}
+
+void Engine::setDeviceRate(int rate) {
+	delete resampler;
+	resampler = rate != sampleRate ? new Resampler(sampleRate, rate) : nullptr;
+}
+
+void Engine::startWorkers() {
+	scheduler.start();
+}
+
+bool Engine::post(const PatchCommand& command) {
+	if (command.type == PatchCommand::SetGraph && outstanding >= queueSize)
+		return false;
+	if (!commands.push(command))
+		return false;
+
+	if (command.type == PatchCommand::SetGraph)
+		outstanding++;
+	return true;
+}
+
+void Engine::collect() {
+	const GraphSnapshot* g;
+	while (retired.pop(g)) {
+		delete g;
+		outstanding--;
+	}
+}
+
+void Engine::apply(const PatchCommand& command) {
+	switch (command.type) {
+	case PatchCommand::SetGraph:
+		for (const Edge& edge : command.graph->edges)
+			edge.input->source = edge.source;
+
+		// Snapshots are freed by the UI thread, never here. The queue can't be full,
+		// post keeps fewer snapshots retired than it holds.
+		if (graph != nullptr)
+			retired.push(graph);
+
+		graph = command.graph;
+		break;
+	}
+}
+
+void Engine::process(float* out, int samples) {
+	meter.begin();
+
+	PatchCommand command;
+	while (commands.pop(command))
+		apply(command);
+
+	if (graph == nullptr) {
+		std::fill_n(out, samples, 0.f);
+		meter.end(samples);
+		return;
+	}
+
+	if (resampler == nullptr) {
+		render(out, samples);
+	} else {
+		// The graph runs as many frames as the filter needs to produce the device's
+		for (int offset = 0; offset < samples; offset += Resampler::maxOutput) {
+			int frames = std::min(samples - offset, Resampler::maxOutput);
+			int needed = resampler->needed(frames);
+			render(resampler->input(needed), needed);
+			resampler->process(out + offset, frames);
+		}
+	}
+
+	meter.end(samples);
+}
+
+void Engine::render(float* out, int samples) {
+	for (int offset = 0; offset < samples; offset += MAX_BLOCK_SIZE) {
+		int nframes = std::min(samples - offset, MAX_BLOCK_SIZE);
+		if (graph->tasks.size() > 1 && scheduler.workerCount() > 0)
+			scheduler.run(graph, nframes);
+		else
+			for (Module* m : graph->schedule)
+				m->process(nframes);
+		std::copy_n(player->buffer, nframes, out + offset);
+	}
+}
\ No newline at end of file
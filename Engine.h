@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Graph.h"
+#include "LoadMeter.h"
+#include "lockfree.h"
+#include "Resampler.h"
+#include "Scheduler.h"
+
+struct PatchCommand {
+	enum Type { SetGraph };
+
+	Type type;
+	const GraphSnapshot* graph;
+};
+
+class Engine {
+public:
+	static const int queueSize = 64;
+
+	LoadMeter meter;
+
+	// Converts the graph's output to the device rate, null when they match
+	Resampler* resampler = nullptr;
+
+	Engine(Player* player);
+
+	// Frees every snapshot, the audio device must be closed
+	~Engine();
+
+	// Only while the audio device is paused
+	void setDeviceRate(int rate);
+
+	// Lets independent branches run in parallel, only while the audio device is paused
+	void startWorkers();
+
+	// Fails when the queue is full or too many snapshots are waiting to be collected, the caller keeps ownership
+	bool post(const PatchCommand& command);
+
+	void collect();
+
+	void process(float* out, int samples);
+
+private:
+	Player* player;
+
+	const GraphSnapshot* graph = nullptr;
+
+	// Snapshots posted and not freed yet, the live one included. Kept at most queueSize, so the audio thread
+	// can always retire one. Only touched by the thread posting and collecting.
+	int outstanding = 0;
+
+	SPSCQueue<PatchCommand, queueSize> commands;
+	SPSCQueue<const GraphSnapshot*, queueSize> retired;
+
+	Scheduler scheduler;
+
+	void apply(const PatchCommand& command);
+
+	void render(float* out, int samples);
+};
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <unordered_map>
+#include "Graph.h"
+
+bool Graph::dirty = true;
+
+void Graph::invalidate() {
+	dirty = true;
+}
+
+// Splits the schedule into tasks for parallel execution.
+// A module joins its source's task when each is the other's only link, so chains run on one thread.
+// Feedback loops are kept together in a single task, in schedule order.
+void Graph::cluster(GraphSnapshot* snapshot, const std::vector<Module*>& modules, const std::vector<int>& order, const std::vector<int>& feedback, const std::vector<std::vector<int>>& successors) {
+	int count = modules.size();
+	std::vector<std::vector<int>> next(count), previous(count);
+	for (int i = 0; i < count; i++) {
+		for (int s : successors[i])
+			if (std::find(next[i].begin(), next[i].end(), s) == next[i].end()) {
+				next[i].push_back(s);
+				previous[s].push_back(i);
+			}
+	}
+
+	std::vector<Task>& tasks = snapshot->tasks;
+	std::vector<int> taskOf(count, -1);
+
+	for (int i : order) {
+		int p = previous[i].size() == 1 ? previous[i][0] : -1;
+		if (p >= 0 && next[p].size() == 1) {
+			taskOf[i] = taskOf[p];
+		} else {
+			taskOf[i] = tasks.size();
+			tasks.push_back(Task{});
+		}
+	}
+
+	if (!feedback.empty()) {
+		for (int i : feedback)
+			taskOf[i] = tasks.size();
+		tasks.push_back(Task{});
+	}
+
+	for (int i : order)
+		tasks[taskOf[i]].modules.push_back(modules[i]);
+	for (int i : feedback)
+		tasks[taskOf[i]].modules.push_back(modules[i]);
+
+	for (int i = 0; i < count; i++) {
+		for (int s : next[i]) {
+			int from = taskOf[i], to = taskOf[s];
+			std::vector<int>& out = tasks[from].successors;
+			if (from != to && std::find(out.begin(), out.end(), to) == out.end()) {
+				out.push_back(to);
+				tasks[to].dependencies++;
+			}
+		}
+	}
+
+	for (int t = 0; t < tasks.size(); t++)
+		if (tasks[t].dependencies == 0)
+			snapshot->roots.push_back(t);
+
+	snapshot->pending = std::vector<std::atomic<int>>(tasks.size());
+}
+
+GraphSnapshot* Graph::compile(const std::vector<Module*>& live) {
+	dirty = false;
+
+	std::vector<Module*> modules;
+	std::unordered_map<Module*, int> index;
+	for (Module* m : live) {
+		if (!m->queueDelete) {
+			index[m] = modules.size();
+			modules.push_back(m);
+		}
+	}
+
+	GraphSnapshot* snapshot = new GraphSnapshot();
+
+	std::vector<int> inDegree(modules.size(), 0);
+	std::vector<std::vector<int>> successors(modules.size());
+	for (int i = 0; i < modules.size(); i++) {
+		for (Input* in : modules[i]->inputs) {
+			Output* source = in->getSource();
+			auto it = source != nullptr ? index.find(source->module) : index.end();
+			if (it == index.end())
+				source = nullptr;
+
+			snapshot->edges.push_back(Edge{ in, source != nullptr ? source->buffer : nullptr });
+
+			if (source != nullptr && it->second != i) {
+				successors[it->second].push_back(i);
+				inDegree[i]++;
+			}
+		}
+	}
+
+	std::vector<Module*>& schedule = snapshot->schedule;
+
+	// Kahn's algorithm, ready modules keep their z-order
+	std::vector<int> ready;
+	for (int i = 0; i < modules.size(); i++)
+		if (inDegree[i] == 0)
+			ready.push_back(i);
+
+	for (int r = 0; r < ready.size(); r++) {
+		int i = ready[r];
+		schedule.push_back(modules[i]);
+		for (int s : successors[i])
+			if (--inDegree[s] == 0)
+				ready.push_back(s);
+	}
+
+	// Modules in a feedback loop read the previous block of their sources
+	std::vector<int> feedback;
+	for (int i = 0; i < modules.size(); i++)
+		if (inDegree[i] > 0) {
+			schedule.push_back(modules[i]);
+			feedback.push_back(i);
+		}
+
+	cluster(snapshot, modules, ready, feedback, successors);
+
+	return snapshot;
+}
\ No newline at end of file
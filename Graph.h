@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "Module.h"
+
+// Resolved connection: the buffer an input reads, or nullptr when it falls back to its own value
+struct Edge {
+	Input* input;
+	const float* source;
+};
+
+// Modules run in order by one thread, then release their successors
+struct Task {
+	std::vector<Module*> modules;
+	std::vector<int> successors;
+	int dependencies;
+};
+
+struct GraphSnapshot {
+	std::vector<Module*> schedule;
+	std::vector<Edge> edges;
+
+	std::vector<Task> tasks;
+	std::vector<int> roots;
+
+	// Dependencies left per task during a block, reset by the scheduler
+	mutable std::vector<std::atomic<int>> pending;
+};
+
+class Graph {
+public:
+	static bool dirty;
+
+	static void invalidate();
+
+	static GraphSnapshot* compile(const std::vector<Module*>& modules);
+
+private:
+	static void cluster(GraphSnapshot* snapshot, const std::vector<Module*>& modules, const std::vector<int>& order, const std::vector<int>& feedback, const std::vector<std::vector<int>>& successors);
+};
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include "audioConfig.h"
+#include "LoadMeter.h"
+
+const float LoadMeter::lateFactor = 1.5;
+
+void LoadMeter::begin() {
+	previousStart = start;
+	start = Clock::now();
+}
+
+void LoadMeter::end(int samples) {
+	Clock::time_point now = Clock::now();
+	std::chrono::duration<float> period(float(samples) / deviceRate);
+
+	float l = std::chrono::duration<float>(now - start) / period;
+	load.store(l, std::memory_order_relaxed);
+
+	float p = peak.load(std::memory_order_relaxed);
+	while (l > p && !peak.compare_exchange_weak(p, l, std::memory_order_relaxed));
+
+	int bin = std::min(int(l * binsPerDeadline), binCount - 1);
+	histogram[bin].fetch_add(1, std::memory_order_relaxed);
+
+	// Slow processing and late scheduling are counted apart to tell a heavy patch from a system hiccup
+	if (l > 1)
+		overruns.fetch_add(1, std::memory_order_relaxed);
+	if (started && start - previousStart > lateFactor * period)
+		underruns.fetch_add(1, std::memory_order_relaxed);
+
+	started = true;
+}
+
+float LoadMeter::takePeak() {
+	return peak.exchange(0, std::memory_order_relaxed);
+}
+
+void LoadMeter::report(std::ostream& out) {
+	out << "DSP load histogram (" << overruns << " overruns, " << underruns << " underruns)" << std::endl;
+	for (int i = 0; i < binCount; i++) {
+		uint32_t count = histogram[i].load(std::memory_order_relaxed);
+		if (count == 0) continue;
+
+		out << "  " << 100 * i / binsPerDeadline << "%";
+		if (i < binCount - 1) out << "-" << 100 * (i + 1) / binsPerDeadline << "%";
+		else out << "+";
+		out << ": " << count << std::endl;
+	}
+}
\ No newline at end of file
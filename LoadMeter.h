@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Times each audio callback against its deadline, written by the audio thread and read lock-free by the UI
+class LoadMeter {
+public:
+	// Load in steps of 1/binsPerDeadline of the deadline, the last bin collects everything slower
+	static const int binsPerDeadline = 16;
+	static const int binCount = 2 * binsPerDeadline + 1;
+
+	// A callback starting this many periods after the previous one means the device ran dry
+	static const float lateFactor;
+
+	std::atomic<uint32_t> histogram[binCount]{};
+	std::atomic<uint32_t> overruns{ 0 }, underruns{ 0 };
+	std::atomic<float> load{ 0 }, peak{ 0 };
+
+	void begin();
+	void end(int samples);
+
+	// Returns the peak since the last call
+	float takePeak();
+
+	void report(std::ostream& out);
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point start, previousStart;
+	bool started = false;
+};
\ No newline at end of file
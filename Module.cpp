@@ -1,10 +1,22 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include "audioConfig.h"
+#include "dsp.h"
+#include "Graph.h"
 #include "Module.h"
 #include "util.h"
+#include "Wavetable.h"
 
 const int Module::borderWidth = 3;
 const int Module::headerHeight = 20;
 
+SpatialGrid<Module> Module::grid;
+
+unsigned Module::raised = 0;
+
 Module::Module(const char* name, int w, int h, int x, int y, bool deletable) : Draggable(x, y) {
 	this->width = w;
 	this->height = h;
@@ -12,30 +24,47 @@ Module::Module(const char* name, int w, int h, int x, int y, bool deletable) : D
 	this->bottom = &this->height;
 
 	this->deletable = deletable;
+	this->type = name;
 
 	title = new EditText(0, 0, std::min(100, deletable ? w - 20 : w), name);
 	addChild(title);
 
 	queueDelete = false;
+
+	bounds = SDL_Rect{ x, y, w, h };
+	grid.insert(this, bounds);
+	raise();
 }
 
-void Module::step() {
-	for (Drawable* d : children) {
-		Output* o = dynamic_cast<Output*>(d);
-		if (o != nullptr)
-			o->step();
-	}
+void Module::addInput(Input* input) {
+	inputs.push_back(input);
+	addChild(input);
+}
+
+void Module::addOutput(Output* output) {
+	outputs.push_back(output);
+	output->module = this;
+	addChild(output);
+}
+
+void Module::process(int nframes) {
+	for (Output* o : outputs)
+		o->process(nframes);
 };
 
+void Module::settle() {}
+
 void Module::draw(Renderer& renderer) {
-	renderer.fillRect(new SDL_Rect{ getX(), getY(), width, height }, borderColor);
+	SDL_Rect border{ getX(), getY(), width, height };
+	renderer.fillRect(&border, borderColor);
 
-	renderer.fillRect(new SDL_Rect{
+	SDL_Rect body{
 		getX() + borderWidth,
 		getY() + headerHeight,
 		width - borderWidth * 2,
 		height - borderWidth - headerHeight,
-	}, bgColor);
+	};
+	renderer.fillRect(&body, bgColor);
 
 	if (deletable) {
 		renderer.line(
@@ -54,14 +83,32 @@ void Module::draw(Renderer& renderer) {
 }
 
 bool Module::inDragArea(int x, int y) {
-	return pointInRect(x, y, new SDL_Rect{ getX(), getY(), width, headerHeight });
+	SDL_Rect header{ getX(), getY(), width, headerHeight };
+	return pointInRect(x, y, &header);
 }
 
 void Module::remove() {
 	queueDelete = true;
+	grid.remove(this, bounds);
+	Graph::invalidate();
 	Drawable::remove();
 }
 
+void Module::moved() {
+	Draggable::moved();
+
+	SDL_Rect r{ x, y, width, height };
+	if (r.x == bounds.x && r.y == bounds.y)
+		return;
+
+	grid.move(this, bounds, r);
+	bounds = r;
+}
+
+void Module::raise() {
+	z = ++raised;
+}
+
 bool Module::onMouseDown(SDL_MouseButtonEvent* evt) {
 	if (deletable && evt->button == SDL_BUTTON_LEFT) {
 		SDL_Rect xRect{ getX() + width - headerHeight, getY(), headerHeight, headerHeight };
@@ -73,59 +120,160 @@ bool Module::onMouseDown(SDL_MouseButtonEvent* evt) {
 
 	if (Draggable::onMouseDown(evt)) return true;
 
-	return pointInRect(evt->x, evt->y, new SDL_Rect{ getX(), getY(), width, height });
+	SDL_Rect rect{ getX(), getY(), width, height };
+	return pointInRect(evt->x, evt->y, &rect);
 }
 
-WaveGenerator::WaveGenerator(int x, int y) : Module("VCO", 150, 130, x, y) {
+WaveGenerator::WaveGenerator(int x, int y) : KernelModule("VCO", 150, 130, x, y) {
 	freq = new KnobInput("  freq", 10, headerHeight + 10, std::vector<float>{ -1, -0.67, -0.33, 0, 0.33, 0.67, 1 });
-	addChild(freq);
+	addInput(freq);
 
-	type = new KnobInput("  type", 80, headerHeight + 10, std::vector<float>{ -1, 0, 1 });
-	addChild(type);
+	type = new KnobInput("  type", 80, headerHeight + 10, std::vector<float>{ -1, -0.5, 0, 0.5, 1 });
+	addInput(type);
 
-	output = new Output("out", 50, headerHeight + freq->height + 15, [this]() {
-		float t = type->getValue();
-		if (t < 0)
-			return (float) (phase > 0.5 ? -1 : 1);
-		return SDL_sinf(2 * M_PI * phase);
-	});
-	addChild(output);
+	output = new Output("out", 50, headerHeight + freq->height + 15);
+	addOutput(output);
 
 	phase = 0;
+	increment = 440 * 4294967296.0 / sampleRate;
+
+	Wavetable::build();
 }
 
-void WaveGenerator::step() {
-	Module::step();
+void WaveGenerator::kernel(float* out, int nframes) {
+	// Phase is a 32-bit fixed-point fraction of a cycle, wrapping on overflow
+	const float scale = 440 * 4294967296.0 / sampleRate;
+
+	Wavetable::Shape shape = Wavetable::shape(type->getControl(nframes));
+
+	float increments[MAX_BLOCK_SIZE];
+	if (freq->isConnected()) {
+		const float* f = freq->getBlock(nframes);
+		for (int i = 0; i < nframes; i++)
+			increments[i] = f[i] * 3;
+		fastExp2(increments, increments, nframes);
+		for (int i = 0; i < nframes; i++)
+			increments[i] *= scale;
+	} else {
+		// Unmodulated pitch: one exp2 per block, ramped from the previous block
+		float target = fastExp2(freq->getControl(nframes) * 3) * scale;
+		float step = (target - increment) / nframes;
+		for (int i = 0; i < nframes; i++)
+			increments[i] = increment + step * (i + 1);
+	}
+	increment = increments[nframes - 1];
+
+	// Converting out of range is undefined, so strong FM is held between 0 and the Nyquist frequency.
+	// The argument order makes a NaN give 0.
+	const float maxIncrement = 2147483520.f;
+	for (int i = 0; i < nframes; i++) {
+		uint32_t inc = std::min(std::max(0.f, increments[i]), maxIncrement);
+		out[i] = Wavetable::sample(shape, phase, inc);
+		phase += inc;
+	}
+}
 
-	phase += 440 * SDL_powf(2, freq->getValue() * 3) / SAMPLE_RATE;
-	if (phase > 1) phase -= 1;
+// The unmodulated pitch starts at the knob's
+void WaveGenerator::settle() {
+	increment = fastExp2(freq->getSetting() * 3) * (440 * 4294967296.0 / sampleRate);
 }
 
-Player::Player(int x, int y) : Module("Player", 80, 90, x, y, false) {
+const int Player::peakHold = 1000;
+const int Player::meterInterval = 250;
+
+Player::Player(int x, int y) : Module("Player", 80, 135, x, y, false) {
 	input = new KnobInput(" input", 10, headerHeight + 10);
-	addChild(input);
+	addInput(input);
+}
+
+void Player::process(int nframes) {
+	std::copy_n(input->getBlock(nframes), nframes, buffer);
+}
+
+void Player::update() {
+	uint32_t now = SDL_GetTicks();
+	if (meter == nullptr || now - meterTime < meterInterval) return;
+	meterTime = now;
+
+	int l = 100 * meter->load.load(std::memory_order_relaxed);
+	int p = peak;
+	if (now - peakTime >= peakHold) {
+		p = 100 * meter->takePeak();
+		peakTime = now;
+	}
+	int x = meter->overruns + meter->underruns;
+
+	if (l != load || p != peak || x != xruns) {
+		load = l;
+		peak = p;
+		xruns = x;
+		Drawable::invalidate();
+	}
 }
 
-const int Scope::bufferLength = 65;
+void Player::draw(Renderer& renderer) {
+	Module::draw(renderer);
+
+	if (meter == nullptr) return;
+
+	int textX = getX() + 10;
+	int textY = getY() + headerHeight + 60;
+
+	char text[32];
+	snprintf(text, sizeof(text), "load %3d%%", load);
+	renderer.renderText(textX, textY, text, textColor);
+
+	snprintf(text, sizeof(text), "peak %3d%%", peak);
+	renderer.renderText(textX, textY + 15, text, peak > 100 ? SDL_Color(0xDD, 0x22, 0x22) : textColor);
+
+	snprintf(text, sizeof(text), "xrun %d", xruns);
+	renderer.renderText(textX, textY + 30, text, textColor);
+}
 
 Scope::Scope(int x, int y) : Module("Scope", 150, 150, x, y) {
 	input = new Input("input", 15, headerHeight + 10, 40, 40);
-	addChild(input);
+	addInput(input);
 
 	rate = new KnobInput("  rate", 75, headerHeight + 10);
-	addChild(rate);
+	addInput(rate);
 
 	n = 0;
+	current = Peak{ INFINITY, -INFINITY };
+	head = 0;
+
+	animated = true;
 }
 
-void Scope::step() {
-	int r = pow(10, rate->getValue() + 1);
-	n++;
-	if (n > r) {
-		buffer.push_back(input->getValue());
-		if (buffer.size() > bufferLength)
-			buffer.erase(buffer.begin());
-		n = 0;
+void Scope::process(int nframes) {
+	const float* in = input->getBlock(nframes);
+	int r = pow(10, rate->getControl(nframes) + 1);
+
+	// Each column keeps the peaks of all the samples it covers
+	bool updated = false;
+	for (int i = 0; i < nframes; i++) {
+		current.min = std::min(current.min, in[i]);
+		current.max = std::max(current.max, in[i]);
+		n++;
+		if (n > r) {
+			ring[head] = current;
+			head = (head + 1) % bufferLength;
+			current = Peak{ INFINITY, -INFINITY };
+			n = 0;
+			updated = true;
+		}
+	}
+
+	if (updated) {
+		std::array<Peak, bufferLength>& peaks = display.write();
+		std::copy(ring + head, ring + bufferLength, peaks.begin());
+		std::copy(ring, ring + head, peaks.begin() + (bufferLength - head));
+
+		// A steady signal scrolls identical columns, which needn't be drawn again
+		if (memcmp(peaks.data(), published.data(), sizeof(peaks)) != 0) {
+			published = peaks;
+			display.publish();
+			Drawable::invalidate();
+		}
 	}
 };
 
@@ -135,132 +283,200 @@ void Scope::draw(Renderer& renderer) {
 	int viewX = getX() + 10;
 	int viewY = getY() + headerHeight + 70;
 
-	renderer.fillRect(new SDL_Rect{ viewX, viewY, 130, 50 }, SDL_Color(0, 0, 0));
+	SDL_Rect view{ viewX, viewY, 130, 50 };
+	renderer.fillRect(&view, SDL_Color(0, 0, 0));
 
-	SDL_Point points[bufferLength]{};
-	for (int i = 0; i < bufferLength; i++)
-		points[i] = SDL_Point(
-			viewX + 2 * i,
-			viewY + 25 - (i < buffer.size() ? buffer[i] * 25 : 0)
-		);
-	renderer.lines(points, bufferLength, SDL_Color(0xF4, 0xF1, 0x86));
+	display.update();
+	const std::array<Peak, bufferLength>& peaks = display.read();
+
+	SDL_Point points[bufferLength * 2]{};
+	for (int i = 0; i < bufferLength; i++) {
+		points[2 * i] = SDL_Point(viewX + 2 * i, viewY + 25 - peaks[i].max * 25);
+		points[2 * i + 1] = SDL_Point(viewX + 2 * i, viewY + 25 - peaks[i].min * 25);
+	}
+	renderer.lines(points, bufferLength * 2, SDL_Color(0xF4, 0xF1, 0x86));
 };
 
-BitCrusher::BitCrusher(int x, int y) : Module("BitCrusher", 130, 130, x, y) {
+BitCrusher::BitCrusher(int x, int y) : KernelModule("BitCrusher", 130, 130, x, y) {
 	input = new Input("input", 10, headerHeight + 10, 40, 40);
-	addChild(input);
+	addInput(input);
 
 	depth = new KnobInput(" depth", 60, headerHeight + 10, std::vector<float>{ -1, -0.75, -0.5, -0.25, 0, 0.25, 0.5, 0.75, 1 });
-	addChild(depth);
+	addInput(depth);
 
-	output = new Output("out", 40, headerHeight + depth->height + 15, [this]() {
-		float bits = pow(2, (depth->getValue() + 1) * 4);
-		return std::min(std::max(round(input->getValue() * bits) / bits, -1.f), 1.f);
-	});
-	addChild(output);
+	output = new Output("out", 40, headerHeight + depth->height + 15);
+	addOutput(output);
+}
+
+void BitCrusher::kernel(float* out, int nframes) {
+	const float* in = input->getBlock(nframes);
+	float bits = pow(2, (depth->getControl(nframes) + 1) * 4);
+	float step = 1 / bits;
+	for (int i = 0; i < nframes; i++)
+		out[i] = std::min(std::max(round(in[i] * bits) * step, -1.f), 1.f);
 }
 
-ADSR::ADSR(int x, int y) : Module("ADSR", 290, 190, x, y) {
+ADSR::ADSR(int x, int y) : KernelModule("ADSR", 290, 190, x, y) {
 	attack = new KnobInput(" attack", 10, headerHeight + 60);
-	addChild(attack);
+	addInput(attack);
 
 	decay = new KnobInput(" decay", 80, headerHeight + 60);
-	addChild(decay);
+	addInput(decay);
 
 	sustain = new KnobInput("sustain", 150, headerHeight + 60);
-	addChild(sustain);
+	addInput(sustain);
 
 	release = new KnobInput("release", 220, headerHeight + 60);
-	addChild(release);
+	addInput(release);
 
 	pressed = false;
 	pressTime = 0;
 	pressValue = 0;
-	releaseTime = SAMPLE_RATE * 2;
+	releaseTime = sampleRate * 2;
 	releaseValue = 0;
 
 	trigger = new ButtonInput("trigger", 80, headerHeight + attack->height + 70);
-	addChild(trigger);
+	addInput(trigger);
+
+	output = new Output("out", 170, headerHeight + attack->height + 75);
+	addOutput(output);
+}
+
+void ADSR::kernel(float* out, int nframes) {
+	const float rate = sampleRate;
+
+	float atk = (attack->getControl(nframes) + 1) / 2;
+	float dec = (decay->getControl(nframes) + 1) / 2;
+	float rel = (release->getControl(nframes) + 1) / 2;
+	float sus = (sustain->getControl(nframes) + 1) / 2;
 
-	output = new Output("out", 170, headerHeight + attack->height + 75, [this]() {
-		float atk = (attack->getValue() + 1) / 2;
-		float dec = (decay->getValue() + 1) / 2;
-		float rel = (release->getValue() + 1) / 2;
-		float sus = (sustain->getValue() + 1) / 2;
+	const float* trig = trigger->getBlock(nframes);
 
+	for (int i = 0; i < nframes; i++) {
 		if (pressed) {
-			pressValue = pressTime / SAMPLE_RATE < atk ? (1 - releaseValue) * pressTime / (SAMPLE_RATE * atk) + releaseValue :
-				pressTime / SAMPLE_RATE < atk + dec ? sus + (1 - sus) * (atk + dec - pressTime / SAMPLE_RATE) / dec :
+			pressValue = pressTime / rate < atk ? (1 - releaseValue) * pressTime / (rate * atk) + releaseValue :
+				pressTime / rate < atk + dec ? sus + (1 - sus) * (atk + dec - pressTime / rate) / dec :
 				sus;
-			return pressValue;
+			out[i] = pressValue;
 		} else {
-			releaseValue = releaseTime / SAMPLE_RATE < rel ? pressValue * (rel - releaseTime / SAMPLE_RATE) / rel : 0;
-			return releaseValue;
+			releaseValue = releaseTime / rate < rel ? pressValue * (rel - releaseTime / rate) / rel : 0;
+			out[i] = releaseValue;
 		}
-	});
-	addChild(output);
+
+		bool p = trig[i] > 0;
+
+		if (!pressed && p) {
+			pressTime = 0;
+			releaseTime = 0;
+		}
+
+		pressed = p;
+
+		if (pressed)
+			pressTime++;
+		else
+			releaseTime++;
+	}
 }
 
 const float Delay::delayMax = 1.0;
+const int Delay::fadeLength = 1024;
 
-Delay::Delay(int x, int y) : Module("Delay", 130, 130, x, y) {
+Delay::Delay(int x, int y) : KernelModule("Delay", 130, 140, x, y) {
 	input = new Input("input", 10, headerHeight + 10, 40, 40);
-	addChild(input);
+	addInput(input);
 
 	amount = new KnobInput("amount", 60, headerHeight + 10, std::vector<float>{ -1, 1 });
+	addInput(amount);
 
-	addChild(amount);
+	cubic = new ButtonInput(" cubic", 75, headerHeight + amount->height + 15, true);
+	addInput(cubic);
 
-	maxSampleStored = SAMPLE_RATE * delayMax;
-	buffer = new float[maxSampleStored];
-	transitionBuffer = new float[maxSampleStored];
+	// Room for the longest delay, one block written ahead of the reads and the interpolation taps
+	maxDelay = sampleRate * delayMax;
+	buffer.resize(std::bit_ceil((unsigned)(maxDelay + MAX_BLOCK_SIZE + 2)));
+	mask = buffer.size() - 1;
 	writeIndex = 0;
-	storedDelayOffset = 0;
 
-	odd = false;
+	delay = previousDelay = delayTime(amount->getValue());
+	fade = 0;
 
-	readIndex = amount->getValue();
-
-	output = new Output("out", 40, headerHeight + amount->height + 15, [this]() {
-		int newDelay = getSampleOffset();
-		int delayDiff = newDelay - storedDelayOffset;
-		storedDelayOffset = newDelay;
-
-
-		int finalIndex = (writeIndex - storedDelayOffset + maxSampleStored) % maxSampleStored;
-		return buffer[finalIndex];
-		});
-	addChild(output);
+	output = new Output("out", 40, headerHeight + amount->height + 15);
+	addOutput(output);
 }
 
-int Delay::getSampleOffset() {
-
-	return ((amount->getValue() + 1) / 2) * (maxSampleStored-1);
+// Taps start at the knob's delay, without a crossfade from the default
+void Delay::settle() {
+	delay = previousDelay = delayTime(amount->getSetting());
+	fade = 0;
 }
 
-void Delay::step() {
-	Module::step();
-
-	writeIndex = (writeIndex + 1) % maxSampleStored;
-	buffer[writeIndex] = input->getValue();
+float Delay::delayTime(float amount) {
+	return std::max((amount + 1) / 2 * maxDelay, 1.f);
 }
 
-void ADSR::step() {
-	Module::step();
+void Delay::kernel(float* out, int nframes) {
+	const float* in = input->getBlock(nframes);
+
+	int start = writeIndex;
+	int first = std::min(nframes, (int)buffer.size() - start);
+	memcpy(&buffer[start], in, first * sizeof(float));
+	memcpy(&buffer[0], in + first, (nframes - first) * sizeof(float));
+	writeIndex = (start + nframes) & mask;
+
+	// Delay changes crossfade between the old and new taps instead of jumping or sliding.
+	// A target arriving during a fade is kept and taken up on the sample that fade ends.
+	float target = delayTime(amount->getControl(nframes));
+	bool hermite = cubic->getControl(nframes) > 0;
+
+	for (int offset = 0; offset < nframes;) {
+		if (fade == 0 && target != delay) {
+			previousDelay = delay;
+			delay = target;
+			fade = fadeLength;
+		}
 
-	bool p = trigger->getValue() > 0;
+		int length = fade > 0 ? std::min(fade, nframes - offset) : nframes - offset;
+		read(start + offset, delay, hermite, out + offset, length);
 
-	if (!pressed && p) {
-		pressTime = 0;
-		releaseTime = 0;
+		if (fade > 0) {
+			read(start + offset, previousDelay, hermite, transitionBuffer, length);
+			for (int i = 0; i < length; i++) {
+				float g = (fade - i) * (1.f / fadeLength);
+				out[offset + i] += (transitionBuffer[i] - out[offset + i]) * g;
+			}
+			fade -= length;
+		}
+		offset += length;
 	}
+}
 
-	pressed = p;
-
-	if (pressed)
-		pressTime++;
-	else
-		releaseTime++;
+void Delay::read(int start, float delay, bool hermite, float* out, int nframes) {
+	// Sample i sits between base + i and base + i + 1, t of the way
+	int whole = delay;
+	float t = 1 - (delay - whole);
+	int base = start - whole - 1 + buffer.size();
+
+	const float* b = buffer.data();
+	if (hermite) {
+		for (int i = 0; i < nframes; i++) {
+			float xm1 = b[(base + i - 1) & mask];
+			float x0 = b[(base + i) & mask];
+			float x1 = b[(base + i + 1) & mask];
+			float x2 = b[(base + i + 2) & mask];
+
+			float c1 = 0.5f * (x1 - xm1);
+			float c2 = xm1 - 2.5f * x0 + 2 * x1 - 0.5f * x2;
+			float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+			out[i] = ((c3 * t + c2) * t + c1) * t + x0;
+		}
+	} else {
+		for (int i = 0; i < nframes; i++) {
+			float x0 = b[(base + i) & mask];
+			float x1 = b[(base + i + 1) & mask];
+			out[i] = x0 + (x1 - x0) * t;
+		}
+	}
 }
 
 void ADSR::draw(Renderer& renderer) {
@@ -287,15 +503,206 @@ void ADSR::draw(Renderer& renderer) {
 	renderer.lines(points, 5, textColor);
 }
 
-Mixer::Mixer(int x, int y) : Module("Mixer", 130, 130, x, y) {
+Mixer::Mixer(int x, int y) : KernelModule("Mixer", 130, 130, x, y) {
 	input = new Input("input", 10, headerHeight + 10, 40, 40);
-	addChild(input);
+	addInput(input);
 
 	volume = new KnobInput("volume", 60, headerHeight + 10);
-	addChild(volume);
+	addInput(volume);
 
-	output = new Output("out", 40, headerHeight + volume->height + 15, [this]() {
-		return input->getValue() * volume->getValue();
-	});
-	addChild(output);
+	output = new Output("out", 40, headerHeight + volume->height + 15);
+	addOutput(output);
+}
+
+void Mixer::kernel(float* out, int nframes) {
+	const float* in = input->getBlock(nframes);
+	const float* v = volume->getBlock(nframes);
+	for (int i = 0; i < nframes; i++)
+		out[i] = in[i] * v[i];
+}
+
+const float Poly::voiceGain = 0.25;
+const char* const Poly::lowerKeys = "zsxdcvgbhnjm";
+const char* const Poly::upperKeys = "q2w3er5t6y7u";
+
+Poly::Poly(int x, int y) : KernelModule("Poly", 290, 160, x, y) {
+	attack = new KnobInput(" attack", 10, headerHeight + 10);
+	addInput(attack);
+
+	decay = new KnobInput(" decay", 80, headerHeight + 10);
+	addInput(decay);
+
+	sustain = new KnobInput("sustain", 150, headerHeight + 10);
+	addInput(sustain);
+
+	release = new KnobInput("release", 220, headerHeight + 10);
+	addInput(release);
+
+	type = new KnobInput("  type", 10, headerHeight + attack->height + 20, std::vector<float>{ -1, -0.5, 0, 0.5, 1 });
+	addInput(type);
+
+	steal = new KnobInput("  steal", 80, headerHeight + attack->height + 20);
+	addInput(steal);
+
+	output = new Output("out", 230, headerHeight + attack->height + 25);
+	addOutput(output);
+
+	std::fill_n(note, voiceCount, -1);
+	animated = true;
+
+	Wavetable::build();
+}
+
+int Poly::keyNote(SDL_Keycode key) {
+	if (key <= 0 || key > 127) return -1;
+
+	const char* k = strchr(lowerKeys, key);
+	if (k != nullptr) return 48 + (k - lowerKeys);
+
+	k = strchr(upperKeys, key);
+	if (k != nullptr) return 60 + (k - upperKeys);
+
+	return -1;
+}
+
+// Note keys are consumed, repeats included, so they never reach the global shortcuts
+bool Poly::onKeyDown(SDL_KeyboardEvent* evt) {
+	// Shortcuts such as Ctrl+S aren't notes
+	if (evt->keysym.mod & (KMOD_CTRL | KMOD_ALT | KMOD_GUI))
+		return false;
+
+	if (Module::onKeyDown(evt))
+		return true;
+	if (EditText::focused != nullptr)
+		return false;
+
+	int n = keyNote(evt->keysym.sym);
+	if (n >= 0 && !evt->repeat)
+		noteOn(n);
+	return n >= 0;
+}
+
+// Releases aren't consumed, so every Poly drops the note even if the stacking order changed
+bool Poly::onKeyUp(SDL_KeyboardEvent* evt) {
+	int n = keyNote(evt->keysym.sym);
+	if (n >= 0)
+		noteOff(n);
+	return Module::onKeyUp(evt);
+}
+
+bool Poly::noteOn(int n) {
+	return events.push(NoteEvent{ n, true });
+}
+
+bool Poly::noteOff(int n) {
+	return events.push(NoteEvent{ n, false });
+}
+
+// A retriggered note keeps its voice, then the longest silent voice is used, then one is stolen
+int Poly::allocate(int n, Steal policy) {
+	for (int v = 0; v < voiceCount; v++)
+		if (note[v] == n)
+			return v;
+
+	int best = -1;
+	for (int v = 0; v < voiceCount; v++)
+		if (gate[v] == 0 && level[v] == 0 && (best < 0 || time[v] > time[best]))
+			best = v;
+	if (best >= 0 || policy == Never)
+		return best;
+
+	for (int v = 0; v < voiceCount; v++) {
+		if (best < 0
+			|| (policy == Oldest && age[v] < age[best])
+			|| (policy == Quietest && level[v] < level[best]))
+			best = v;
+	}
+	return best;
+}
+
+void Poly::kernel(float* out, int nframes) {
+	float atk = std::max((attack->getControl(nframes) + 1) / 2 * sampleRate, 1.f);
+	float dec = std::max((decay->getControl(nframes) + 1) / 2 * sampleRate, 1.f);
+	float rel = std::max((release->getControl(nframes) + 1) / 2 * sampleRate, 1.f);
+	float sus = (sustain->getControl(nframes) + 1) / 2;
+	float invAtk = 1 / atk, invDec = 1 / dec, invRel = 1 / rel;
+
+	Wavetable::Shape shape = Wavetable::shape(type->getControl(nframes));
+	Steal policy = (Steal)std::clamp((int)std::round(steal->getControl(nframes) + 1), 0, 2);
+
+	// Notes change on block boundaries, so gates are constant within a block
+	NoteEvent e;
+	while (events.pop(e)) {
+		int v;
+		if (e.on) {
+			v = allocate(e.note, policy);
+			if (v < 0) continue;
+
+			note[v] = e.note;
+			age[v] = clock++;
+			increment[v] = 440 * 4294967296.0 / sampleRate * std::exp2((e.note - 69) / 12.f);
+			gate[v] = 1;
+		} else {
+			v = std::find(note, note + voiceCount, e.note) - note;
+			if (v == voiceCount || gate[v] == 0) continue;
+
+			note[v] = -1;
+			gate[v] = 0;
+		}
+		start[v] = level[v];
+		time[v] = 0;
+	}
+
+	// Increments only change with notes, so each voice's table level is chosen once per block
+	const float* levels = Wavetable::levelsOf(shape);
+	alignas(32) int32_t offsets[voiceCount];
+	uint32_t sound = 0;
+	for (int v = 0; v < voiceCount; v++) {
+		offsets[v] = Wavetable::offset(increment[v]);
+		if (gate[v] != 0 || level[v] != 0)
+			sound |= 1u << v;
+	}
+
+	alignas(32) float env[laneBlock][voiceCount];
+
+	for (int offset = 0; offset < nframes; offset += laneBlock) {
+		int n = std::min(laneBlock, nframes - offset);
+
+		// Envelopes for all voices at once, branch free so each sample is a few SIMD operations across voices
+		for (int i = 0; i < n; i++) {
+			for (int v = 0; v < voiceCount; v++) {
+				float t = time[v] + i;
+				float attacking = start[v] + (1 - start[v]) * t * invAtk;
+				float decaying = sus + (1 - sus) * (atk + dec - t) * invDec;
+				float held = t < atk ? attacking : t < atk + dec ? decaying : sus;
+				float released = t < rel ? start[v] * (rel - t) * invRel : 0;
+				env[i][v] = gate[v] > 0 ? held : released;
+			}
+		}
+
+		// Oscillators with the voices as SIMD lanes, a silent voice only adds a zero weight
+		for (int i = 0; i < n; i++)
+			out[offset + i] = oscillatorLanes(levels, offsets, phase, increment, env[i], voiceCount, Wavetable::fracBits);
+
+		for (int v = 0; v < voiceCount; v++) {
+			level[v] = env[n - 1][v];
+			time[v] = std::min(time[v] + n, 1e7f);
+		}
+	}
+
+	for (int i = 0; i < nframes; i++)
+		out[i] *= voiceGain;
+
+	if (sounding.exchange(sound, std::memory_order_relaxed) != sound)
+		Drawable::invalidate();
+}
+
+void Poly::draw(Renderer& renderer) {
+	Module::draw(renderer);
+
+	uint32_t sound = sounding.load(std::memory_order_relaxed);
+	for (int v = 0; v < voiceCount; v++) {
+		SDL_Rect rect{ getX() + 150 + (v % 8) * 12, getY() + headerHeight + 70 + (v / 8) * 12, 8, 8 };
+		renderer.fillRect(&rect, sound & (1u << v) ? SDL_Color(0xF4, 0xF1, 0x86) : borderColor);
+	}
 }
\ No newline at end of file
@@ -1,89 +1,177 @@
 #pragma once
 
+#include <array>
 #include "Drawable.h"
+#include "LoadMeter.h"
+#include "lockfree.h"
+#include "SpatialGrid.h"
 
 class Module : public Draggable {
 public:
 	static const int borderWidth;
 	static const int headerHeight;
 
+	// Bounds of every module on screen, for hit testing and socket snapping
+	static SpatialGrid<Module> grid;
+
 	bool deletable;
 
+	// Set by modules whose view is updated from the audio thread, the UI polls for it every frame slot
+	bool animated = false;
+
+	const char* type;
+
 	EditText* title;
 
 	int width, height;
 
+	// Stacking order, the module raised last is in front
+	unsigned z;
+
+	std::vector<Input*> inputs;
+	std::vector<Output*> outputs;
+
 	Module(const char* name, int w, int h, int x, int y, bool deletable = true);
 
-	virtual void step();
+	void addInput(Input* input);
+	void addOutput(Output* output);
+
+	virtual void process(int nframes);
+
+	// Snaps smoothed state to the current settings instead of gliding from the old ones, before the module runs
+	virtual void settle();
 
 	virtual void draw(Renderer& renderer);
 
 	virtual void remove();
 
+	virtual void moved();
+
+	void raise();
+
 	bool inDragArea(int x, int y);
 
 	bool onMouseDown(SDL_MouseButtonEvent* evt);
+
+private:
+	static unsigned raised;
+
+	SDL_Rect bounds;
 };
 
-class WaveGenerator : public Module {
+// Modules with a single output computed by a statically dispatched Derived::kernel(out, nframes)
+template <typename Derived>
+class KernelModule : public Module {
+public:
+	KernelModule(const char* name, int w, int h, int x, int y, bool deletable = true);
+
+	virtual void process(int nframes);
+
+protected:
+	Output* output;
+};
+
+template <typename Derived>
+KernelModule<Derived>::KernelModule(const char* name, int w, int h, int x, int y, bool deletable)
+	: Module(name, w, h, x, y, deletable) {
+	output = nullptr;
+}
+
+template <typename Derived>
+void KernelModule<Derived>::process(int nframes) {
+	static_cast<Derived*>(this)->kernel(output->buffer, nframes);
+	output->value = output->buffer[nframes - 1];
+}
+
+class WaveGenerator : public KernelModule<WaveGenerator> {
 public:
 	WaveGenerator(int x, int y);
 
-	virtual void step();
+	void kernel(float* out, int nframes);
+
+	virtual void settle();
 
 private:
-	float phase;
+	uint32_t phase;
+	float increment;
 
 	Input* freq;
 	Input* type;
-
-	Output* output;
 };
 
 class Player : public Module {
 public:
 	static const float delta;
 
+	static const int peakHold;
+	static const int meterInterval;
+
 	Input* input;
 
+	float buffer[MAX_BLOCK_SIZE]{};
+
+	LoadMeter* meter = nullptr;
+
 	Player(int x, int y);
+
+	virtual void process(int nframes);
+
+	virtual void draw(Renderer& renderer);
+
+	// Samples the load meter at a fixed rate, invalidating only when the shown numbers change
+	void update();
+
+private:
+	int load = 0, peak = 0, xruns = 0;
+	uint32_t meterTime = 0, peakTime = 0;
 };
 
 class Scope : public Module {
 public:
-	static const int bufferLength;
+	static const int bufferLength = 65;
+
+	struct Peak {
+		float min, max;
+	};
 
 	Scope(int x, int y);
 
-	virtual void step();
+	virtual void process(int nframes);
 
 	virtual void draw(Renderer& renderer);
 
 private:
 	int n;
-	std::vector<float> buffer;
+	Peak current;
+
+	Peak ring[bufferLength]{};
+	int head;
+
+	TripleBuffer<std::array<Peak, bufferLength>> display;
+
+	// Copy of the last peaks handed to the display, only used by the audio thread
+	std::array<Peak, bufferLength> published{};
 
 	Input* input;
 	Input* rate;
 };
 
-class BitCrusher : public Module {
+class BitCrusher : public KernelModule<BitCrusher> {
 public:
 	BitCrusher(int x, int y);
 
+	void kernel(float* out, int nframes);
+
 private:
 	Input* input;
 	Input* depth;
-
-	Output* output;
 };
 
-class ADSR : public Module {
+class ADSR : public KernelModule<ADSR> {
 public:
 	ADSR(int x, int y);
 
-	virtual void step();
+	void kernel(float* out, int nframes);
 
 	virtual void draw(Renderer& renderer);
 
@@ -101,43 +189,107 @@ private:
 	Input* release;
 
 	Input* trigger;
-
-	Output* output;
 };
 
-
-class Delay : public Module {
+class Delay : public KernelModule<Delay> {
 public:
 	Delay(int x, int y);
 
+	void kernel(float* out, int nframes);
 
-	virtual void step();
-	virtual int getSampleOffset();
+	virtual void settle();
 
 private:
+	static const float delayMax;
+	static const int fadeLength;
+
 	Input* input;
 	Input* amount;
+	Input* cubic;
 
-	static const float delayMax;
-	int maxSampleStored;
+	float maxDelay;
 
-	int storedDelayOffset;
-	float* buffer;
-	float* transitionBuffer;
-	int writeIndex, readIndex;
+	std::vector<float> buffer;
+	float transitionBuffer[MAX_BLOCK_SIZE];
+	int mask;
+	int writeIndex;
 
-	bool odd;
+	float delay, previousDelay;
+	int fade;
 
-	Output* output;
+	float delayTime(float amount);
+
+	void read(int start, float delay, bool hermite, float* out, int nframes);
 };
 
-class Mixer : public Module {
+class Mixer : public KernelModule<Mixer> {
 public:
 	Mixer(int x, int y);
 
+	void kernel(float* out, int nframes);
+
 private:
 	Input* input;
 	Input* volume;
+};
 
-	Output* output;
+// Sixteen oscillator and envelope voices played from the computer keyboard, mixed to one output
+class Poly : public KernelModule<Poly> {
+public:
+	enum Steal { Oldest, Quietest, Never };
+
+	static constexpr int voiceCount = 16;
+	static constexpr int laneBlock = 64;
+	static const float voiceGain;
+
+	// Two rows of a piano layout, starting from C3 and C4
+	static const char* const lowerKeys;
+	static const char* const upperKeys;
+
+	Poly(int x, int y);
+
+	void kernel(float* out, int nframes);
+
+	virtual void draw(Renderer& renderer);
+
+	virtual bool onKeyDown(SDL_KeyboardEvent* evt);
+	virtual bool onKeyUp(SDL_KeyboardEvent* evt);
+
+	// Called from the UI thread, applied at the start of the next block
+	bool noteOn(int note);
+	bool noteOff(int note);
+
+private:
+	struct NoteEvent {
+		int note;
+		bool on;
+	};
+
+	SPSCQueue<NoteEvent, 256> events;
+
+	// Voice state as structure of arrays, one lane per voice
+	alignas(32) uint32_t phase[voiceCount]{};
+	alignas(32) uint32_t increment[voiceCount]{};
+	alignas(32) float gate[voiceCount]{};
+	alignas(32) float time[voiceCount]{};
+	alignas(32) float start[voiceCount]{};
+	alignas(32) float level[voiceCount]{};
+	int note[voiceCount];
+	uint32_t age[voiceCount]{};
+
+	uint32_t clock = 0;
+
+	// Bit per voice still sounding, for display
+	std::atomic<uint32_t> sounding{ 0 };
+
+	Input* type;
+	Input* attack;
+	Input* decay;
+	Input* sustain;
+	Input* release;
+	Input* steal;
+
+	static int keyNote(SDL_Keycode key);
+
+	int allocate(int n, Steal policy);
 };
\ No newline at end of file
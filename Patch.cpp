@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "Component.h"
+#include "Graph.h"
+#include "Patch.h"
+
+const char* const Patch::binaryExtension = ".msb";
+
+static const char textMagic[] = "modsynth-patch";
+static const char binaryMagic[4] = { 'M', 'S', 'Y', 'N' };
+
+// Stored by index in binary patches, only ever append to this list
+static const struct {
+	const char* type;
+	Module* (*create)(int x, int y);
+} moduleTypes[] = {
+	{ "Player", nullptr },
+	{ "VCO", [](int x, int y) -> Module* { return new WaveGenerator(x, y); } },
+	{ "Mixer", [](int x, int y) -> Module* { return new Mixer(x, y); } },
+	{ "ADSR", [](int x, int y) -> Module* { return new ADSR(x, y); } },
+	{ "Scope", [](int x, int y) -> Module* { return new Scope(x, y); } },
+	{ "BitCrusher", [](int x, int y) -> Module* { return new BitCrusher(x, y); } },
+	{ "Delay", [](int x, int y) -> Module* { return new Delay(x, y); } },
+	{ "Poly", [](int x, int y) -> Module* { return new Poly(x, y); } },
+};
+
+static const int moduleTypeCount = sizeof(moduleTypes) / sizeof(moduleTypes[0]);
+
+static int typeIndex(const char* type) {
+	for (int i = 0; i < moduleTypeCount; i++)
+		if (strcmp(moduleTypes[i].type, type) == 0)
+			return i;
+	return -1;
+}
+
+struct PatchEndpoint {
+	int32_t module, socket;
+	int32_t x, y;
+};
+
+struct PatchModule {
+	uint32_t type;
+	int32_t x, y;
+	uint32_t firstValue, valueCount;
+	uint32_t titleOffset, titleLength;
+};
+
+struct PatchCable {
+	uint8_t r, g, b, a;
+	PatchEndpoint start, end;
+};
+
+struct PatchHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t moduleCount, cableCount, valueCount, titleBytes;
+};
+
+// Flat description of a patch shared by both formats
+struct PatchData {
+	std::vector<PatchModule> modules;
+	std::vector<PatchCable> cables;
+	std::vector<float> values;
+	std::string titles;
+};
+
+static Socket* moduleSocket(Module* m, int i) {
+	if (i < 0) return nullptr;
+	if (i < m->inputs.size()) return m->inputs[i]->socket;
+	i -= m->inputs.size();
+	return i < m->outputs.size() ? m->outputs[i]->socket : nullptr;
+}
+
+static PatchData collect(const std::vector<Cable*>& liveCables, const std::vector<Module*>& liveModules) {
+	PatchData data;
+
+	std::unordered_map<Socket*, std::pair<int, int>> sockets;
+	std::vector<Module*> modules;
+	for (Module* m : liveModules) {
+		if (m->queueDelete) continue;
+		int s = 0;
+		for (Input* in : m->inputs)
+			sockets[in->socket] = { (int)modules.size(), s++ };
+		for (Output* out : m->outputs)
+			sockets[out->socket] = { (int)modules.size(), s++ };
+		modules.push_back(m);
+	}
+
+	std::vector<Cable*> cables;
+	for (Cable* c : liveCables)
+		if (!c->queueDelete)
+			cables.push_back(c);
+
+	for (Module* m : modules) {
+		PatchModule pm{};
+		pm.type = typeIndex(m->type);
+		pm.x = m->x;
+		pm.y = m->y;
+		pm.firstValue = data.values.size();
+		pm.valueCount = m->inputs.size();
+		pm.titleOffset = data.titles.size();
+		pm.titleLength = m->title->text.size();
+
+		for (Input* in : m->inputs)
+			data.values.push_back(in->getSetting());
+		data.titles += m->title->text;
+		data.modules.push_back(pm);
+	}
+
+	auto endpoint = [&](Connector* c) {
+		auto it = c->socket != nullptr ? sockets.find(c->socket) : sockets.end();
+		if (it == sockets.end())
+			return PatchEndpoint{ -1, -1, c->x, c->y };
+		return PatchEndpoint{ it->second.first, it->second.second, c->x, c->y };
+	};
+
+	for (Cable* c : cables)
+		data.cables.push_back(PatchCable{ c->color.r, c->color.g, c->color.b, c->color.a, endpoint(c->start), endpoint(c->end) });
+
+	return data;
+}
+
+static void writeText(std::ofstream& file, const PatchData& data) {
+	file << textMagic << " " << Patch::version << "\n";
+
+	for (const PatchModule& m : data.modules) {
+		file << "module " << moduleTypes[m.type].type << " " << m.x << " " << m.y << " " << m.valueCount;
+		for (int i = 0; i < m.valueCount; i++)
+			file << " " << data.values[m.firstValue + i];
+		file << " " << data.titles.substr(m.titleOffset, m.titleLength) << "\n";
+	}
+
+	auto endpoint = [&](const PatchEndpoint& e) {
+		if (e.module < 0)
+			file << " @" << e.x << "," << e.y;
+		else
+			file << " " << e.module << ":" << e.socket;
+	};
+
+	for (const PatchCable& c : data.cables) {
+		file << "cable " << (int)c.r << " " << (int)c.g << " " << (int)c.b;
+		endpoint(c.start);
+		endpoint(c.end);
+		file << "\n";
+	}
+}
+
+static void writeBinary(std::ofstream& file, const PatchData& data) {
+	PatchHeader header{};
+	memcpy(header.magic, binaryMagic, 4);
+	header.version = Patch::version;
+	header.moduleCount = data.modules.size();
+	header.cableCount = data.cables.size();
+	header.valueCount = data.values.size();
+	header.titleBytes = data.titles.size();
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(data.modules.data()), data.modules.size() * sizeof(PatchModule));
+	file.write(reinterpret_cast<const char*>(data.cables.data()), data.cables.size() * sizeof(PatchCable));
+	file.write(reinterpret_cast<const char*>(data.values.data()), data.values.size() * sizeof(float));
+	file.write(data.titles.data(), data.titles.size());
+}
+
+void Patch::save(const char* path, const std::vector<Cable*>& cables, const std::vector<Module*>& modules) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		throw ComponentException("Couldn't open patch file for writing");
+
+	PatchData data = collect(cables, modules);
+
+	size_t length = strlen(path), extension = strlen(binaryExtension);
+	if (length >= extension && strcmp(path + length - extension, binaryExtension) == 0)
+		writeBinary(file, data);
+	else
+		writeText(file, data);
+
+	file.flush();
+	if (!file)
+		throw ComponentException("Couldn't write patch file");
+}
+
+static PatchData readText(const std::string& contents) {
+	PatchData data;
+	std::istringstream in(contents);
+
+	std::string line, word;
+	std::getline(in, line);
+
+	auto endpoint = [](std::istringstream& ls) {
+		PatchEndpoint e{ -1, -1, 0, 0 };
+		std::string token;
+		ls >> token;
+		if (token.size() > 0 && token[0] == '@')
+			sscanf(token.c_str(), "@%d,%d", &e.x, &e.y);
+		else
+			sscanf(token.c_str(), "%d:%d", &e.module, &e.socket);
+		return e;
+	};
+
+	while (std::getline(in, line)) {
+		std::istringstream ls(line);
+		ls >> word;
+
+		if (word == "module") {
+			PatchModule m{};
+			std::string type;
+			ls >> type >> m.x >> m.y >> m.valueCount;
+
+			int t = typeIndex(type.c_str());
+			if (t < 0)
+				throw ComponentException("Unknown module type in patch");
+			m.type = t;
+
+			m.firstValue = data.values.size();
+			for (int i = 0; i < m.valueCount; i++) {
+				float v;
+				if (!(ls >> v))
+					throw ComponentException("Corrupted patch file");
+				data.values.push_back(v);
+			}
+
+			std::string title;
+			std::getline(ls >> std::ws, title);
+			m.titleOffset = data.titles.size();
+			m.titleLength = title.size();
+			data.titles += title;
+
+			data.modules.push_back(m);
+		} else if (word == "cable") {
+			int r, g, b;
+			ls >> r >> g >> b;
+			PatchCable c{ (uint8_t)r, (uint8_t)g, (uint8_t)b, 0xFF };
+			c.start = endpoint(ls);
+			c.end = endpoint(ls);
+			data.cables.push_back(c);
+		}
+	}
+
+	return data;
+}
+
+static PatchData readBinary(const std::string& contents) {
+	PatchData data;
+
+	PatchHeader header;
+	if (contents.size() < sizeof(header))
+		throw ComponentException("Truncated patch file");
+	memcpy(&header, contents.data(), sizeof(header));
+
+	size_t size = sizeof(header)
+		+ header.moduleCount * sizeof(PatchModule)
+		+ header.cableCount * sizeof(PatchCable)
+		+ header.valueCount * sizeof(float)
+		+ header.titleBytes;
+	if (contents.size() < size)
+		throw ComponentException("Truncated patch file");
+
+	// Empty sections are skipped, data() may be null for an empty vector
+	const char* p = contents.data() + sizeof(header);
+	data.modules.resize(header.moduleCount);
+	if (header.moduleCount > 0)
+		memcpy(data.modules.data(), p, header.moduleCount * sizeof(PatchModule));
+	p += header.moduleCount * sizeof(PatchModule);
+
+	data.cables.resize(header.cableCount);
+	if (header.cableCount > 0)
+		memcpy(data.cables.data(), p, header.cableCount * sizeof(PatchCable));
+	p += header.cableCount * sizeof(PatchCable);
+
+	data.values.resize(header.valueCount);
+	if (header.valueCount > 0)
+		memcpy(data.values.data(), p, header.valueCount * sizeof(float));
+	p += header.valueCount * sizeof(float);
+
+	data.titles.assign(p, header.titleBytes);
+
+	// Ranges are checked without summing, which could wrap around
+	for (const PatchModule& m : data.modules)
+		if (m.type >= moduleTypeCount
+			|| m.firstValue > data.values.size() || m.valueCount > data.values.size() - m.firstValue
+			|| m.titleOffset > data.titles.size() || m.titleLength > data.titles.size() - m.titleOffset)
+			throw ComponentException("Corrupted patch file");
+
+	return data;
+}
+
+void Patch::load(const char* path, std::vector<Cable*>& cables, std::vector<Module*>& modules, Player* player) {
+	// The whole file is read at once, then parsed from memory
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw ComponentException("Couldn't open patch file");
+
+	// Streamed rather than sized with tellg, which is meaningless for a directory
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	std::string contents = buffer.str();
+
+	PatchData data;
+	if (contents.compare(0, 4, binaryMagic, 4) == 0) {
+		data = readBinary(contents);
+		if (reinterpret_cast<const PatchHeader*>(contents.data())->version > version)
+			throw ComponentException("Patch was saved by a newer version");
+	} else if (contents.compare(0, sizeof(textMagic) - 1, textMagic) == 0) {
+		if (atoi(contents.c_str() + sizeof(textMagic)) > version)
+			throw ComponentException("Patch was saved by a newer version");
+		data = readText(contents);
+	} else {
+		throw ComponentException("Not a patch file");
+	}
+
+	// There is a single player to place
+	if (std::count_if(data.modules.begin(), data.modules.end(), [](const PatchModule& m) { return moduleTypes[m.type].create == nullptr; }) > 1)
+		throw ComponentException("Corrupted patch file");
+
+	std::vector<Module*> loaded;
+	loaded.reserve(data.modules.size());
+	for (const PatchModule& pm : data.modules) {
+		Module* m = moduleTypes[pm.type].create ? moduleTypes[pm.type].create(pm.x, pm.y) : player;
+		m->x = pm.x;
+		m->y = pm.y;
+		m->moved();
+		m->title->text = data.titles.substr(pm.titleOffset, pm.titleLength);
+		for (int i = 0; i < pm.valueCount && i < m->inputs.size(); i++)
+			m->inputs[i]->setSetting(data.values[pm.firstValue + i]);
+		m->settle();
+		loaded.push_back(m);
+	}
+
+	auto plug = [&](Connector* c, const PatchEndpoint& e) {
+		Socket* s = e.module >= 0 && e.module < loaded.size() ? moduleSocket(loaded[e.module], e.socket) : nullptr;
+		if (s != nullptr) {
+			c->plug(s);
+		} else {
+			c->x = e.x;
+			c->y = e.y;
+			Drawable::relayout();
+		}
+	};
+
+	for (const PatchCable& pc : data.cables) {
+		Cable* cable = new Cable(0, 0, SDL_Color{ pc.r, pc.g, pc.b, pc.a });
+		plug(cable->start, pc.start);
+		plug(cable->end, pc.end);
+		cables.push_back(cable);
+	}
+
+	modules.insert(modules.end(), loaded.begin(), loaded.end());
+	for (auto it = loaded.rbegin(); it != loaded.rend(); it++)
+		(*it)->raise();
+	Graph::invalidate();
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+#include "Module.h"
+
+// Patches are saved as text unless the path ends in binaryExtension, loading detects the format
+class Patch {
+public:
+	static const int version = 1;
+	static const char* const binaryExtension;
+
+	static void save(const char* path, const std::vector<Cable*>& cables, const std::vector<Module*>& modules);
+
+	// Appends the patch's cables and modules, reusing player for the Player module
+	static void load(const char* path, std::vector<Cable*>& cables, std::vector<Module*>& modules, Player* player);
+};
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "dsp.h"
+#include "Resampler.h"
+
+constexpr double pi = 3.14159265358979323846;
+
+const float Resampler::beta = 8.6;
+
+// Modified Bessel function of the first kind, for the Kaiser window
+static double bessel0(double x) {
+	double sum = 1, term = 1;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+Resampler::Resampler(int inRate, int outRate) {
+	this->inRate = inRate;
+	step = ((uint64_t)inRate << 32) / outRate;
+
+	// Half the Kaiser window's transition band below the lower of the two Nyquist frequencies, relative to the input's,
+	// so the stopband starts where aliases and images would
+	double attenuation = beta / 0.1102 + 8.7;
+	double transition = (attenuation - 7.95) / (2.285 * (taps - 1) * pi);
+	double cutoff = std::min(1.0, (double)outRate / inRate) - transition / 2;
+
+	const int half = taps / 2;
+	coefficients.resize((phases + 1) * taps);
+	for (int r = 0; r <= phases; r++) {
+		float* row = &coefficients[r * taps];
+		double sum = 0;
+		for (int j = 0; j < taps; j++) {
+			double d = j - (half - 1) - (double)r / phases;
+			double x = cutoff * d * pi;
+			double sinc = x == 0 ? 1 : std::sin(x) / x;
+			double w = d / half;
+			double window = std::abs(w) >= 1 ? 0 : bessel0(beta * std::sqrt(1 - w * w)) / bessel0(beta);
+			row[j] = cutoff * sinc * window;
+			sum += row[j];
+		}
+		for (int j = 0; j < taps; j++)
+			row[j] /= sum;
+	}
+
+	// Starts on silence, the first output frame is centred on the first input frame
+	int maxInput = (int)(((uint64_t)maxOutput * step) >> 32) + 2;
+	buffer.assign(maxInput + 2 * taps, 0);
+	filled = half - 1;
+	position = (uint64_t)(half - 1) << 32;
+}
+
+int Resampler::needed(int frames) {
+	uint64_t last = position + (frames - 1) * step;
+	return std::max(0, (int)(last >> 32) + taps / 2 + 1 - filled);
+}
+
+float* Resampler::input(int frames) {
+	float* p = &buffer[filled];
+	filled += frames;
+	return p;
+}
+
+void Resampler::process(float* out, int frames) {
+	const int half = taps / 2;
+	for (int i = 0; i < frames; i++) {
+		int index = position >> 32;
+		uint32_t fraction = (uint32_t)position;
+
+		// The top bits pick the phase, the rest interpolates towards the next one
+		int phase = fraction >> 24;
+		float t = (fraction & 0xFFFFFF) * (1.f / (1 << 24));
+
+		out[i] = interpolatedDot(&buffer[index - (half - 1)], &coefficients[phase * taps], &coefficients[(phase + 1) * taps], t, taps);
+		position += step;
+	}
+
+	// Keep only what the next output frame reaches back to
+	int consumed = (int)(position >> 32) - (half - 1);
+	if (consumed > 0) {
+		memmove(buffer.data(), buffer.data() + consumed, (filled - consumed) * sizeof(float));
+		filled -= consumed;
+		position -= (uint64_t)consumed << 32;
+	}
+}
+
+float Resampler::latency() {
+	return float(taps / 2) / inRate;
+}
+
+double Resampler::response(double frequency) {
+	// The rows interleave into one filter sampled phases times per input frame
+	const int half = taps / 2;
+	double f = 2 * pi * frequency / inRate;
+	double re = 0, im = 0;
+	for (int r = 0; r < phases; r++) {
+		const float* row = &coefficients[r * taps];
+		for (int j = 0; j < taps; j++) {
+			double d = j - (half - 1) - (double)r / phases;
+			re += row[j] * std::cos(f * d);
+			im -= row[j] * std::sin(f * d);
+		}
+	}
+	return std::sqrt(re * re + im * im) / phases;
+}
\ No newline at end of file
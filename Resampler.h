@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "audioConfig.h"
+
+// Windowed-sinc polyphase resampler converting the graph's output to the device rate.
+// Any ratio is supported by interpolating between the two nearest of phases filters.
+class Resampler {
+public:
+	static const int taps = 64;
+	static const int phases = 256;
+	static const float beta;
+
+	// Most output frames produced per process call
+	static constexpr int maxOutput = MAX_BLOCK_SIZE;
+
+	Resampler(int inRate, int outRate);
+
+	// Input frames to write with input() before producing frames output frames
+	int needed(int frames);
+
+	// Where to write the next frames input frames
+	float* input(int frames);
+
+	void process(float* out, int frames);
+
+	// Delay added by the filter, in seconds
+	float latency();
+
+	// Magnitude of the filter's response at a frequency in Hz, relative to its DC gain
+	double response(double frequency);
+
+private:
+	int inRate;
+
+	// Input frames per output frame and position of the next output frame in buffer, both 32.32 fixed point
+	uint64_t step;
+	uint64_t position;
+
+	// phases + 1 rows of taps, the last one being the first shifted by one input frame
+	std::vector<float> coefficients;
+
+	std::vector<float> buffer;
+	int filled;
+};
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <SDL2/SDL.h>
+#include "Scheduler.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CPU_PAUSE() _mm_pause()
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_PAUSE() _mm_pause()
+#else
+#define CPU_PAUSE() std::this_thread::yield()
+#endif
+
+Scheduler::Scheduler() : workers(1 + std::clamp<int>(std::thread::hardware_concurrency() - 1, 0, maxWorkers)) {}
+
+void Scheduler::start() {
+	if (!threads.empty()) return;
+
+	for (int i = 1; i < workers.size(); i++)
+		threads.emplace_back(&Scheduler::work, this, i);
+}
+
+Scheduler::~Scheduler() {
+	stopping = true;
+	wake.release(threads.size());
+	for (std::thread& t : threads)
+		t.join();
+}
+
+int Scheduler::workerCount() {
+	return threads.size();
+}
+
+void Scheduler::run(const GraphSnapshot* graph, int nframes) {
+	this->graph = graph;
+	this->nframes = nframes;
+
+	for (int t = 0; t < graph->tasks.size(); t++)
+		graph->pending[t].store(graph->tasks[t].dependencies, std::memory_order_relaxed);
+	remaining.store(graph->tasks.size(), std::memory_order_relaxed);
+
+	for (int t : graph->roots)
+		if (!workers[0].deque.push(t))
+			execute(0, t);
+
+	int asleep = sleeping.exchange(0, std::memory_order_acq_rel);
+	if (asleep > 0)
+		wake.release(asleep);
+
+	// The calling thread works too, then waits for tasks still running elsewhere
+	int task;
+	while (remaining.load(std::memory_order_acquire) > 0) {
+		if (find(0, task))
+			execute(0, task);
+		else
+			CPU_PAUSE();
+	}
+}
+
+void Scheduler::work(int id) {
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+
+	int idle = 0, task;
+	while (!stopping.load(std::memory_order_relaxed)) {
+		if (find(id, task)) {
+			execute(id, task);
+			idle = 0;
+		} else if (++idle < spinLimit) {
+			CPU_PAUSE();
+		} else {
+			// A worker that falls asleep mid-block only leaves its share to the others
+			sleeping.fetch_add(1, std::memory_order_acq_rel);
+			wake.acquire();
+			idle = 0;
+		}
+	}
+}
+
+bool Scheduler::find(int id, int& task) {
+	if (workers[id].deque.pop(task))
+		return true;
+
+	for (int i = 1; i < workers.size(); i++)
+		if (workers[(id + i) % workers.size()].deque.steal(task))
+			return true;
+
+	return false;
+}
+
+// Runs a task and follows its chain: the last successor it releases is run next, the others are pushed for stealing
+void Scheduler::execute(int id, int task) {
+	while (task >= 0) {
+		const Task& t = graph->tasks[task];
+		for (Module* m : t.modules)
+			m->process(nframes);
+
+		int next = -1;
+		for (int s : t.successors) {
+			if (graph->pending[s].fetch_sub(1, std::memory_order_acq_rel) != 1)
+				continue;
+
+			if (next >= 0 && !workers[id].deque.push(next))
+				execute(id, next);
+			next = s;
+		}
+
+		remaining.fetch_sub(1, std::memory_order_release);
+		task = next;
+	}
+}
\ No newline at end of file
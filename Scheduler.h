@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <semaphore>
+#include <thread>
+#include <vector>
+#include "Graph.h"
+#include "lockfree.h"
+
+// Runs a snapshot's tasks on the calling thread plus a pool of workers that steal from each other
+class Scheduler {
+public:
+	static constexpr int maxWorkers = 7;
+	static const int dequeSize = 1024;
+	static const int spinLimit = 20000;
+
+	Scheduler();
+	~Scheduler();
+
+	// Starts the worker threads, until then run isn't used. Only while no block is running.
+	void start();
+
+	int workerCount();
+
+	// Returns once every task of the block has run
+	void run(const GraphSnapshot* graph, int nframes);
+
+private:
+	struct alignas(64) Worker {
+		WorkStealingDeque<int, dequeSize> deque;
+	};
+
+	// Slot 0 belongs to the thread calling run
+	std::vector<Worker> workers;
+	std::vector<std::thread> threads;
+
+	const GraphSnapshot* graph = nullptr;
+	int nframes = 0;
+
+	alignas(64) std::atomic<int> remaining{ 0 };
+	alignas(64) std::atomic<int> sleeping{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::counting_semaphore<> wake{ 0 };
+
+	void work(int id);
+
+	bool find(int id, int& task);
+
+	void execute(int id, int task);
+};
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <SDL2/SDL_rect.h>
+
+// Uniform grid over screen space, each cell lists the items whose bounds overlap it
+template <typename T>
+class SpatialGrid {
+public:
+	static const int cellSize = 128;
+	static const int bucketCount = 1024;
+
+	void insert(T* item, const SDL_Rect& bounds) {
+		if (buckets.empty())
+			buckets.resize(bucketCount);
+
+		Span s = span(bounds);
+		for (int cy = s.y0; cy <= s.y1; cy++)
+			for (int cx = s.x0; cx <= s.x1; cx++) {
+				// Two cells of the same item may share a bucket, it is listed there once
+				std::vector<Entry>& b = bucket(cx, cy);
+				if (std::none_of(b.begin(), b.end(), [&](const Entry& e) { return e.item == item; }))
+					b.push_back(Entry{ item, bounds });
+			}
+	}
+
+	void remove(T* item, const SDL_Rect& bounds) {
+		if (buckets.empty())
+			return;
+
+		Span s = span(bounds);
+		for (int cy = s.y0; cy <= s.y1; cy++)
+			for (int cx = s.x0; cx <= s.x1; cx++) {
+				std::vector<Entry>& b = bucket(cx, cy);
+				for (int i = 0; i < b.size(); i++) {
+					if (b[i].item == item) {
+						b[i] = b.back();
+						b.pop_back();
+						break;
+					}
+				}
+			}
+	}
+
+	void move(T* item, const SDL_Rect& from, const SDL_Rect& to) {
+		remove(item, from);
+		insert(item, to);
+	}
+
+	// Calls visit once for every item whose bounds overlap area
+	template <typename F>
+	void query(const SDL_Rect& area, F visit) {
+		if (buckets.empty())
+			return;
+
+		Span s = span(area);
+		for (int cy = s.y0; cy <= s.y1; cy++)
+			for (int cx = s.x0; cx <= s.x1; cx++)
+				for (const Entry& e : bucket(cx, cy)) {
+					if (!overlaps(e.bounds, area))
+						continue;
+
+					// An item spanning several cells is only reported from the first one the area shares with it
+					Span es = span(e.bounds);
+					if (cx != std::max(s.x0, es.x0) || cy != std::max(s.y0, es.y0))
+						continue;
+
+					visit(e.item);
+				}
+	}
+
+private:
+	struct Entry {
+		T* item;
+		SDL_Rect bounds;
+	};
+
+	struct Span {
+		int x0, y0, x1, y1;
+	};
+
+	// Cells are hashed into a fixed set of buckets, so the grid is unbounded and needs no dynamic initialization
+	std::vector<std::vector<Entry>> buckets;
+
+	static int cell(int v) {
+		return v >= 0 ? v / cellSize : (v + 1) / cellSize - 1;
+	}
+
+	static Span span(const SDL_Rect& r) {
+		return Span{ cell(r.x), cell(r.y), cell(r.x + std::max(r.w, 1) - 1), cell(r.y + std::max(r.h, 1) - 1) };
+	}
+
+	static bool overlaps(const SDL_Rect& a, const SDL_Rect& b) {
+		return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+	}
+
+	std::vector<Entry>& bucket(int cx, int cy) {
+		return buckets[(unsigned)(cx * 73856093 ^ cy * 19349663) & (bucketCount - 1)];
+	}
+};
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include <cmath>
+#include <vector>
+#include "Wavetable.h"
+
+// M_PI needs _USE_MATH_DEFINES with MSVC
+constexpr double pi = 3.14159265358979323846;
+
+bool Wavetable::built = false;
+
+float Wavetable::tables[SHAPE_COUNT][levels][size + 1];
+
+static double harmonic(Wavetable::Shape shape, int h) {
+	switch (shape) {
+	case Wavetable::Square:
+		return h % 2 ? 4 / (pi * h) : 0;
+	case Wavetable::Saw:
+		return (h % 2 ? 2 : -2) / (pi * h);
+	case Wavetable::Triangle:
+		return h % 2 ? ((h / 2) % 2 ? -8 : 8) / (pi * pi * h * h) : 0;
+	default:
+		return h == 1;
+	}
+}
+
+void Wavetable::build() {
+	if (built) return;
+	built = true;
+
+	float* sine = tables[Sine][0];
+	for (int i = 0; i < size; i++)
+		sine[i] = sin(2 * pi * i / size);
+	sine[size] = sine[0];
+
+	for (int level = 1; level < levels; level++)
+		std::copy_n(sine, size + 1, tables[Sine][level]);
+
+	// Additive synthesis from the sine table, each level adds the octave of harmonics the level above lacks
+	std::vector<double> sum(size);
+	for (Shape shape : { Square, Saw, Triangle }) {
+		std::fill(sum.begin(), sum.end(), 0);
+
+		int h = 1;
+		for (int level = levels - 1; level >= 0; level--) {
+			for (; h <= (size / 2) >> level; h++) {
+				double amp = harmonic(shape, h);
+				if (amp == 0) continue;
+
+				for (int i = 0; i < size; i++)
+					sum[i] += amp * sine[(i * h) & (size - 1)];
+			}
+
+			float* table = tables[shape][level];
+			for (int i = 0; i < size; i++)
+				table[i] = sum[i];
+			table[size] = table[0];
+		}
+	}
+}
\ No newline at end of file
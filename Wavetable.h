@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+class Wavetable {
+public:
+	enum Shape { Square, Saw, Sine, Triangle, SHAPE_COUNT };
+
+	static const int sizeBits = 11;
+	static const int size = 1 << sizeBits;
+
+	// Bits of a 32-bit phase below the table index
+	static const int fracBits = 32 - sizeBits;
+
+	// One level per octave, level k holds harmonics up to (size / 2) >> k
+	static const int levels = sizeBits;
+
+	static void build();
+
+	static Shape shape(float type);
+
+	static float sample(Shape shape, uint32_t phase, uint32_t increment);
+
+	// Band-limited table for a fixed increment, to hoist the level choice out of a loop
+	static const float* table(Shape shape, uint32_t increment);
+
+	// The levels of a shape are contiguous, the table for an increment starts at offset(increment) from levelsOf(shape).
+	// Lets oscillators with different increments read through one base pointer.
+	static const float* levelsOf(Shape shape);
+	static int offset(uint32_t increment);
+
+	static float read(const float* table, uint32_t phase);
+
+private:
+	static bool built;
+
+	static float tables[SHAPE_COUNT][levels][size + 1];
+};
+
+inline Wavetable::Shape Wavetable::shape(float type) {
+	return (Shape)std::clamp((int)((type + 1) * 2), 0, SHAPE_COUNT - 1);
+}
+
+inline const float* Wavetable::table(Shape shape, uint32_t increment) {
+	return levelsOf(shape) + offset(increment);
+}
+
+inline const float* Wavetable::levelsOf(Shape shape) {
+	return tables[shape][0];
+}
+
+inline int Wavetable::offset(uint32_t increment) {
+	// Lowest level whose highest harmonic stays under the Nyquist frequency
+	int level = std::min((int)std::bit_width((increment - 1) >> fracBits), levels - 1);
+
+	return level * (size + 1);
+}
+
+inline float Wavetable::read(const float* table, uint32_t phase) {
+	uint32_t i = phase >> fracBits;
+	float frac = (phase & ((1u << fracBits) - 1)) * (1.f / (1u << fracBits));
+	return table[i] + (table[i + 1] - table[i]) * frac;
+}
+
+inline float Wavetable::sample(Shape shape, uint32_t phase, uint32_t increment) {
+	return read(table(shape, increment), phase);
+}
\ No newline at end of file
@@ -0,0 +1,5 @@
+#include "audioConfig.h"
+
+int sampleRate = DEFAULT_SAMPLE_RATE;
+int deviceRate = DEFAULT_SAMPLE_RATE;
+int bufferSize = DEFAULT_BUFFER_SIZE;
\ No newline at end of file
@@ -1,4 +1,14 @@
 #pragma once
 
-const int SAMPLE_RATE = 44100;
-const int BUFFER_SIZE = 1024;
\ No newline at end of file
+const int DEFAULT_SAMPLE_RATE = 48000;
+const int DEFAULT_BUFFER_SIZE = 1024;
+
+// Longest block processed at once, larger device buffers are split into blocks
+const int MAX_BLOCK_SIZE = 1024;
+
+// Rate the graph runs at, fixed at startup so patches sound the same on any device
+extern int sampleRate;
+
+// What the audio device grants, the graph's output is resampled when the rates differ
+extern int deviceRate;
+extern int bufferSize;
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "dsp.h"
+
+#if defined(DSP_AVX2)
+typedef __m256 vfloat;
+typedef __m256i vint;
+const int LANES = 8;
+
+#define vload _mm256_loadu_ps
+#define vstore _mm256_storeu_ps
+#define vset1 _mm256_set1_ps
+#define vadd _mm256_add_ps
+#define vsub _mm256_sub_ps
+#define vmul _mm256_mul_ps
+#define vround(a) _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define vtoint _mm256_cvtps_epi32
+#define vexponent(n) _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23))
+
+#define vloadi(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vstorei(p, a) _mm256_storeu_si256((__m256i*)(p), a)
+#define vset1i _mm256_set1_epi32
+#define vaddi _mm256_add_epi32
+#define vandi _mm256_and_si256
+#define vsrli(a, bits) _mm256_srl_epi32(a, _mm_cvtsi32_si128(bits))
+#define vtofloat _mm256_cvtepi32_ps
+
+static inline vfloat vgather(const float* table, vint index) {
+	return _mm256_i32gather_ps(table, index, 4);
+}
+#elif defined(DSP_SSE2)
+typedef __m128 vfloat;
+typedef __m128i vint;
+const int LANES = 4;
+
+#define vload _mm_loadu_ps
+#define vstore _mm_storeu_ps
+#define vset1 _mm_set1_ps
+#define vadd _mm_add_ps
+#define vsub _mm_sub_ps
+#define vmul _mm_mul_ps
+#define vround(a) _mm_cvtepi32_ps(_mm_cvtps_epi32(a))
+#define vtoint _mm_cvtps_epi32
+#define vexponent(n) _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23))
+
+#define vloadi(p) _mm_loadu_si128((const __m128i*)(p))
+#define vstorei(p, a) _mm_storeu_si128((__m128i*)(p), a)
+#define vset1i _mm_set1_epi32
+#define vaddi _mm_add_epi32
+#define vandi _mm_and_si128
+#define vsrli(a, bits) _mm_srl_epi32(a, _mm_cvtsi32_si128(bits))
+#define vtofloat _mm_cvtepi32_ps
+
+// SSE2 has no gather, the lane reads are scalar and the arithmetic around them stays vectorized
+static inline vfloat vgather(const float* table, vint index) {
+	int32_t i[LANES];
+	vstorei(i, index);
+	return _mm_setr_ps(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+}
+#endif
+
+void fastExp2(const float* x, float* out, int n) {
+	int i = 0;
+#if defined(DSP_AVX2) || defined(DSP_SSE2)
+	for (; i + LANES <= n; i += LANES) {
+		vfloat v = vload(x + i);
+		vfloat r = vround(v);
+		vfloat f = vmul(vsub(v, r), vset1(0.693147181f));
+
+		vfloat p = vset1(1.f / 720);
+		p = vadd(vmul(p, f), vset1(1.f / 120));
+		p = vadd(vmul(p, f), vset1(1.f / 24));
+		p = vadd(vmul(p, f), vset1(1.f / 6));
+		p = vadd(vmul(p, f), vset1(1.f / 2));
+		p = vadd(vmul(p, f), vset1(1));
+		p = vadd(vmul(p, f), vset1(1));
+
+		vstore(out + i, vmul(p, vexponent(vtoint(r))));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = fastExp2(x[i]);
+}
+
+float interpolatedDot(const float* x, const float* a, const float* b, float t, int n) {
+	int i = 0;
+	float sum = 0;
+#if defined(DSP_AVX2) || defined(DSP_SSE2)
+	vfloat acc = vset1(0);
+	vfloat vt = vset1(t);
+	for (; i + LANES <= n; i += LANES) {
+		vfloat va = vload(a + i);
+		vfloat c = vadd(va, vmul(vsub(vload(b + i), va), vt));
+		acc = vadd(acc, vmul(vload(x + i), c));
+	}
+
+	float lanes[LANES];
+	vstore(lanes, acc);
+	for (int l = 0; l < LANES; l++)
+		sum += lanes[l];
+#endif
+	for (; i < n; i++)
+		sum += x[i] * (a[i] + (b[i] - a[i]) * t);
+	return sum;
+}
+
+float oscillatorLanes(const float* table, const int32_t* offset, uint32_t* phase, const uint32_t* increment, const float* gain, int n, int fracBits) {
+	const uint32_t mask = (1u << fracBits) - 1;
+	const float scale = 1.f / (1u << fracBits);
+
+	int l = 0;
+	float sum = 0;
+#if defined(DSP_AVX2) || defined(DSP_SSE2)
+	vfloat acc = vset1(0);
+	for (; l + LANES <= n; l += LANES) {
+		vint p = vloadi(phase + l);
+		vint index = vaddi(vsrli(p, fracBits), vloadi(offset + l));
+		vfloat frac = vmul(vtofloat(vandi(p, vset1i(mask))), vset1(scale));
+
+		vfloat a = vgather(table, index);
+		vfloat b = vgather(table + 1, index);
+		acc = vadd(acc, vmul(vadd(a, vmul(vsub(b, a), frac)), vload(gain + l)));
+
+		vstorei(phase + l, vaddi(p, vloadi(increment + l)));
+	}
+
+	float lanes[LANES];
+	vstore(lanes, acc);
+	for (int k = 0; k < LANES; k++)
+		sum += lanes[k];
+#endif
+	for (; l < n; l++) {
+		uint32_t p = phase[l];
+		const float* t = table + offset[l] + (p >> fracBits);
+		sum += (t[0] + (t[1] - t[0]) * ((p & mask) * scale)) * gain[l];
+		phase[l] = p + increment[l];
+	}
+	return sum;
+}
\ No newline at end of file
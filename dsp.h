@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define DSP_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DSP_SSE2
+#include <emmintrin.h>
+#endif
+
+// 2^x, relative error below 3e-7 for x in [-126, 126]
+inline float fastExp2(float x) {
+	float n = (float)(int)(x + (x < 0 ? -0.5f : 0.5f));
+	float f = (x - n) * 0.693147181f;
+	float p = 1 + f * (1 + f * (1.f / 2 + f * (1.f / 6 + f * (1.f / 24 + f * (1.f / 120 + f * (1.f / 720))))));
+
+	int32_t bits = ((int32_t)n + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return p * scale;
+}
+
+void fastExp2(const float* x, float* out, int n);
+
+// One sample of n oscillators summed: table + offset[l] read at phase[l] with linear interpolation and weighted by
+// gain[l], then phase[l] advanced by increment[l]. Phases are 32-bit fractions of a cycle with fracBits below the index.
+float oscillatorLanes(const float* table, const int32_t* offset, uint32_t* phase, const uint32_t* increment, const float* gain, int n, int fracBits);
+
+// Sum of x[i] * (a[i] + (b[i] - a[i]) * t), a dot product with coefficients interpolated between two rows
+float interpolatedDot(const float* x, const float* a, const float* b, float t, int n);
\ No newline at end of file
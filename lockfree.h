@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t N>
+class SPSCQueue {
+	static_assert((N & (N - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+	bool push(const T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N)
+			return false;
+
+		items[t & (N - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = items[h & (N - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<size_t> tail{ 0 };
+
+	T items[N];
+};
+
+// Latest-value handoff between one writer and one reader, neither side ever waits
+template <typename T>
+class TripleBuffer {
+public:
+	T& write() {
+		return buffers[back];
+	}
+
+	void publish() {
+		back = middle.exchange(back | dirty, std::memory_order_acq_rel) & ~dirty;
+	}
+
+	bool update() {
+		if (!(middle.load(std::memory_order_relaxed) & dirty))
+			return false;
+
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~dirty;
+		return true;
+	}
+
+	const T& read() const {
+		return buffers[front];
+	}
+
+private:
+	static const int dirty = 4;
+
+	T buffers[3]{};
+
+	int back = 0;
+	int front = 1;
+	std::atomic<int> middle{ 2 };
+};
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, other threads steal from the top
+template <typename T, size_t N>
+class WorkStealingDeque {
+	static_assert((N & (N - 1)) == 0, "WorkStealingDeque capacity must be a power of two");
+
+public:
+	bool push(const T& item) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		if (b - top.load(std::memory_order_acquire) >= (int64_t)N)
+			return false;
+
+		items[b & (N - 1)].store(item, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		item = items[b & (N - 1)].load(std::memory_order_relaxed);
+		if (t == b) {
+			// Last item, race the thieves for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	bool steal(T& item) {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+
+		item = items[t & (N - 1)].load(std::memory_order_relaxed);
+		return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> top{ 0 };
+	alignas(64) std::atomic<int64_t> bottom{ 0 };
+
+	std::atomic<T> items[N];
+};
\ No newline at end of file
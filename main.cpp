@@ -1,16 +1,33 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <SDL2/SDL.h>
 #include "audioConfig.h"
+#include "Bench.h"
 #include "Component.h"
+#include "Engine.h"
+#include "Graph.h"
 #include "Module.h"
+#include "Patch.h"
 #include "window.h"
 
 SDL_Color red{ 0xDD, 0x22, 0x22 };
 
-std::vector<Drawable*> objects;
+// Front to back, the menu is drawn above the cables, which are above the modules
+std::vector<Cable*> cables;
+std::vector<Module*> modules;
+
+static const char* defaultPatchPath = "patch.txt";
+
+static const int minSampleRate = 8000, maxSampleRate = 192000;
+static const int minBufferSize = 16, maxBufferSize = 8192;
+static const int lowLatencyBufferSize = 64;
 
 static SDL_Color randomColor() {
 	float angle = 2 * M_PI * std::rand() / RAND_MAX;
@@ -24,160 +41,364 @@ static SDL_Color randomColor() {
 
 Player player(20, 20);
 
-static void insert_object(Drawable* d) {
-	int i = 0;
-	while (dynamic_cast<Module*>(objects[i]) == nullptr) i++;
-	objects.insert(objects.begin() + i, d);
+Engine engine(&player);
+
+static void insert_module(Module* m) {
+	modules.insert(modules.begin(), m);
+	Graph::invalidate();
+}
+
+static void connect(Output* output, Input* input) {
+	Cable* cable = new Cable(0, 0, randomColor());
+	cable->start->plug(output->socket);
+	cable->end->plug(input->socket);
+	cables.insert(cables.begin(), cable);
 }
 
 Menu moduleMenu(0, 0, 120, std::vector<MenuOption>{
 	MenuOption("Add cable/module"),
 	MenuOption("Cable", [](int x, int y) {
-		Cable* cable = new Cable(x, y, randomColor());
-		objects.insert(objects.begin() + 1, cable);
+		cables.insert(cables.begin(), new Cable(x, y, randomColor()));
 	}),
 	MenuOption("VCO", [](int x, int y) {
-		insert_object(new WaveGenerator(x, y));
+		insert_module(new WaveGenerator(x, y));
 	}),
 	MenuOption("Mixer", [](int x, int y) {
-		insert_object(new Mixer(x, y));
+		insert_module(new Mixer(x, y));
 	}),
 	MenuOption("ADSR", [](int x, int y) {
-		insert_object(new ADSR(x, y));
+		insert_module(new ADSR(x, y));
 	}),
 	MenuOption("Scope", [](int x, int y) {
-		insert_object(new Scope(x, y));
+		insert_module(new Scope(x, y));
 	}),
 	MenuOption("BitCrusher", [](int x, int y) {
-		insert_object(new BitCrusher(x, y));
+		insert_module(new BitCrusher(x, y));
 	}),
 	MenuOption("Delay", [](int x, int y) {
-		objects.push_back(new Delay(x, y));
+		insert_module(new Delay(x, y));
+	}),
+	MenuOption("Poly", [](int x, int y) {
+		insert_module(new Poly(x, y));
 	}),
 });
 
 SDL_AudioSpec audioSpec {
-	.freq = SAMPLE_RATE,
+	.freq = DEFAULT_SAMPLE_RATE,
 	.format = AUDIO_F32,
 	.channels = 1,
-	.samples = BUFFER_SIZE,
+	.samples = DEFAULT_BUFFER_SIZE,
 	.callback = [](void* userdata, uint8_t * stream, int len) {
-		auto buffer = reinterpret_cast<float*>(stream);
-		int samples = len / sizeof(float);
-
-		for (int i = 0; i < samples; i++) {
-			for (Drawable* obj : objects) {
-				Module* m = dynamic_cast<Module*>(obj);
-				if (m != nullptr)
-					m->step();
-			}
-			buffer[i] = player.input->getValue();
-		}
+		engine.process(reinterpret_cast<float*>(stream), len / sizeof(float));
 	},
 };
 
+// Runs the graph without SDL as fast as possible and writes the result to a WAV file at the device rate
+static int render(const char* path, float seconds) {
+	if (modules.size() == 1 && cables.empty()) {
+		WaveGenerator* vco = new WaveGenerator(150, 20);
+		insert_module(vco);
+		connect(vco->outputs[0], player.input);
+		player.input->setSetting(0.5f);
+	}
+
+	engine.post(PatchCommand{ PatchCommand::SetGraph, Graph::compile(modules) });
+
+	engine.setDeviceRate(deviceRate);
+	engine.startWorkers();
+	WavFile wav(path, deviceRate);
+
+	std::vector<float> buffer(bufferSize);
+	long total = seconds * deviceRate;
+
+	auto start = std::chrono::steady_clock::now();
+	for (long done = 0; done < total; done += bufferSize) {
+		int samples = std::min<long>(bufferSize, total - done);
+		engine.process(buffer.data(), samples);
+		wav.write(buffer.data(), samples);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	engine.collect();
+
+	std::cout << "Rendered " << seconds << "s to " << path << " in " << elapsed.count() << "s ("
+		<< seconds / elapsed.count() << "x real time)" << std::endl;
+	return 0;
+}
+
 int main(int argc, char* args[]) {
 	std::srand(std::time(nullptr));
 
+	modules = { &player };
+
+	const char* renderPath = nullptr;
+	const char* patchPath = nullptr;
+	float renderSeconds = 10;
+	int requestedDeviceRate = 0;
+	bool bench = false, check = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(args[i], "--render") == 0 && i + 1 < argc)
+			renderPath = args[++i];
+		else if (strcmp(args[i], "--seconds") == 0 && i + 1 < argc)
+			renderSeconds = atof(args[++i]);
+		else if (strcmp(args[i], "--patch") == 0 && i + 1 < argc)
+			patchPath = args[++i];
+		else if (strcmp(args[i], "--rate") == 0 && i + 1 < argc)
+			sampleRate = std::clamp(atoi(args[++i]), minSampleRate, maxSampleRate);
+		else if (strcmp(args[i], "--device-rate") == 0 && i + 1 < argc)
+			requestedDeviceRate = std::clamp(atoi(args[++i]), minSampleRate, maxSampleRate);
+		else if (strcmp(args[i], "--buffer") == 0 && i + 1 < argc)
+			bufferSize = std::bit_ceil((unsigned)std::clamp(atoi(args[++i]), minBufferSize, maxBufferSize));
+		else if (strcmp(args[i], "--low-latency") == 0)
+			bufferSize = lowLatencyBufferSize;
+		else if (strcmp(args[i], "--bench") == 0)
+			bench = true;
+		else if (strcmp(args[i], "--check") == 0)
+			check = true;
+	}
+
+	deviceRate = requestedDeviceRate > 0 ? requestedDeviceRate : sampleRate;
+
+	if (check)
+		return Bench::check(std::cout) ? 0 : 1;
+
+	if (bench) {
+		Bench::run(std::cout);
+		return 0;
+	}
+
+	if (patchPath != nullptr) {
+		std::ifstream exists(patchPath);
+		if (exists) {
+			modules.clear();
+			try {
+				Patch::load(patchPath, cables, modules, &player);
+			}
+			catch (ComponentException& e) {
+				std::cerr << patchPath << ": " << e.what() << std::endl;
+				return 1;
+			}
+			if (std::find(modules.begin(), modules.end(), &player) == modules.end())
+				modules.push_back(&player);
+		}
+	}
+
+	if (renderPath != nullptr)
+		return render(renderPath, renderSeconds);
+
 	new SDL(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
 	new TTF();
 
-	Renderer renderer(window);
+	window = new Window("modsynth", 800, 600);
+	Renderer renderer(*window);
 
+	// The graph keeps its rate whatever the device grants, the engine resamples to the device before it starts
+	audioSpec.freq = deviceRate;
+	audioSpec.samples = bufferSize;
 	AudioDevice audio(&audioSpec);
+	deviceRate = audioSpec.freq;
+	bufferSize = audioSpec.samples;
+	engine.setDeviceRate(deviceRate);
+	engine.startWorkers();
+	audio.resume();
 
-	objects = { &moduleMenu, &player };
+	std::cout << "Audio at " << deviceRate << " Hz, " << bufferSize << " samples per buffer ("
+		<< 1000.0 * bufferSize / deviceRate << " ms)" << std::endl;
+	if (engine.resampler != nullptr)
+		std::cout << "Graph at " << sampleRate << " Hz, resampling adds "
+			<< 1000 * engine.resampler->latency() << " ms" << std::endl;
 
 	bool running = true;
-	while (running) {
-		SDL_Event e;
-		while (SDL_PollEvent(&e)) {
-			if (e.type == SDL_QUIT)
-				running = false;
 
-			if (e.type == SDL_MOUSEBUTTONDOWN) {
-				bool handled = false;
-				for (int i = 0; i < objects.size(); i++) {
-					Drawable* o = objects[i];
-					if (o->onMouseDown(&e.button)) {
-						handled = true;
+	// The object that took the last mouse down gets the motion and release that follow
+	Drawable* captured = nullptr;
 
-						if (dynamic_cast<Module*>(o) != nullptr) {
-							int j = 0;
-							while (dynamic_cast<Module*>(objects[j]) == nullptr) j++;
-							objects.erase(objects.begin() + i);
-							objects.insert(objects.begin() + j, o);
-						}
+	auto handle = [&](SDL_Event& e) {
+		// Motion only matters when something handles it, every other event may change the scene
+		if (e.type != SDL_MOUSEMOTION)
+			Drawable::invalidate();
 
-						break;
-					}
-				}
-				if (!handled && e.button.button == SDL_BUTTON_RIGHT) {
-					moduleMenu.x = e.button.x;
-					moduleMenu.y = e.button.y;
-					moduleMenu.open = true;
-				}
+		if (e.type == SDL_QUIT)
+			running = false;
+
+		if (e.type == SDL_MOUSEBUTTONDOWN) {
+			bool handled = EditText::focused != nullptr && EditText::focused->onMouseDown(&e.button);
+			captured = nullptr;
+
+			if (!handled && moduleMenu.onMouseDown(&e.button)) {
+				handled = true;
+				captured = &moduleMenu;
 			}
-			else if (e.type == SDL_MOUSEBUTTONUP)
-				for (Drawable* o : objects) {
-					if (o->onMouseUp(&e.button))
-						break;
-				}
-			else if (e.type == SDL_MOUSEMOTION)
-				for (Drawable* o : objects) {
-					if (o->onMouseMotion(&e.motion))
-						break;
+
+			for (int i = 0; !handled && i < cables.size(); i++) {
+				if (cables[i]->onMouseDown(&e.button)) {
+					handled = true;
+					captured = cables[i];
 				}
-			else if (e.type == SDL_KEYDOWN) {
-				bool handled = false;
-				for (Drawable* o : objects) {
-					if (o->onKeyDown(&e.key)) {
+			}
+
+			// Only the modules under the cursor can take the click, tried front to back
+			if (!handled) {
+				std::vector<Module*> hits;
+				SDL_Rect point{ e.button.x, e.button.y, 1, 1 };
+				Module::grid.query(point, [&](Module* m) { hits.push_back(m); });
+				std::sort(hits.begin(), hits.end(), [](Module* a, Module* b) { return a->z > b->z; });
+
+				for (Module* m : hits) {
+					if (m->onMouseDown(&e.button)) {
 						handled = true;
+						captured = m;
+						m->raise();
+						modules.erase(std::find(modules.begin(), modules.end(), m));
+						modules.insert(modules.begin(), m);
 						break;
 					}
 				}
-				if (!handled && e.key.keysym.scancode == SDLK_ESCAPE)
-					running = false;
 			}
-			else if (e.type == SDL_TEXTINPUT)
-				for (Drawable* o : objects) {
-					if (o->onTextInput(&e.text))
-						break;
+
+			if (!handled && e.button.button == SDL_BUTTON_RIGHT) {
+				moduleMenu.x = e.button.x;
+				moduleMenu.y = e.button.y;
+				Drawable::relayout();
+				moduleMenu.open = true;
+			}
+		}
+		else if (e.type == SDL_MOUSEBUTTONUP) {
+			if (!moduleMenu.onMouseUp(&e.button) && captured != nullptr)
+				captured->onMouseUp(&e.button);
+			captured = nullptr;
+		}
+		else if (e.type == SDL_MOUSEMOTION) {
+			if (moduleMenu.onMouseMotion(&e.motion) || (captured != nullptr && captured->onMouseMotion(&e.motion)))
+				Drawable::invalidate();
+		}
+		else if (e.type == SDL_KEYDOWN) {
+			// Every module hears the key, so all the Poly modules play a note
+			bool handled = false;
+			for (Module* m : modules)
+				handled |= m->onKeyDown(&e.key);
+			if (!handled && e.key.keysym.sym == SDLK_s && (e.key.keysym.mod & KMOD_CTRL)) {
+				// A failed save must not end the session
+				const char* path = patchPath != nullptr ? patchPath : defaultPatchPath;
+				try {
+					Patch::save(path, cables, modules);
 				}
-			else if (e.type == SDL_WINDOWEVENT) {
-				if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-					window.width = e.window.data1;
-					window.height = e.window.data2;
-
-					for (Drawable* obj : objects) {
-						Draggable* d = dynamic_cast<Draggable*>(obj);
-						if (d != nullptr)
-							d->constrain();
-
-						Cable* c = dynamic_cast<Cable*>(obj);
-						if (c != nullptr) {
-							c->start->constrain();
-							c->end->constrain();
-						}
-					}
+				catch (ComponentException& e) {
+					SDL_Log("%s: %s", path, e.what());
+					SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Couldn't save patch", e.what(), window->sdl);
+				}
+			}
+			else if (!handled && e.key.keysym.sym == SDLK_ESCAPE)
+				running = false;
+		}
+		else if (e.type == SDL_KEYUP)
+			for (Module* m : modules) {
+				if (m->onKeyUp(&e.key))
+					break;
+			}
+		else if (e.type == SDL_TEXTINPUT) {
+			if (EditText::focused != nullptr)
+				EditText::focused->onTextInput(&e.text);
+		}
+		else if (e.type == SDL_WINDOWEVENT) {
+			if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
+				window->width = e.window.data1;
+				window->height = e.window.data2;
+
+				for (Module* m : modules)
+					m->constrain();
+
+				for (Cable* c : cables) {
+					c->start->constrain();
+					c->end->constrain();
 				}
 			}
 		}
+	};
 
-		renderer.fillRect(new SDL_Rect{ 0, 0, window.width, window.height }, SDL_Color{ 0, 0, 0 });
+	// Queued motion is merged into one event carrying the latest position and the summed movement.
+	// It is dispatched at the next frame slot, or earlier before another event so presses and releases
+	// still see where the mouse was.
+	SDL_Event motion;
+	bool moving = false;
+	auto queue = [&](SDL_Event& e) {
+		if (e.type == SDL_MOUSEMOTION) {
+			if (moving) {
+				e.motion.xrel += motion.motion.xrel;
+				e.motion.yrel += motion.motion.yrel;
+			}
+			motion = e;
+			moving = true;
+			return;
+		}
+		if (moving) {
+			moving = false;
+			handle(motion);
+		}
+		handle(e);
+	};
 
-		for (int i = objects.size() - 1; i >= 0; i--) {
-			Drawable* obj = objects[i];
-			if (obj->queueDelete) {
-				objects.erase(objects.begin() + i);
-				i--;
-			} else {
-				obj->draw(renderer);
+	Uint32 lastFrame = 0;
+
+	while (running) {
+		// Sleep until input arrives, the next meter sample, or the next frame slot when something is pending.
+		// The audio thread never wakes this loop, so it is polled every frame slot while a module it draws is live.
+		bool animated = std::any_of(modules.begin(), modules.end(), [](Module* m) { return m->animated; });
+		int untilFrame = lastFrame + renderer.frameInterval - SDL_GetTicks();
+		int timeout = Drawable::dirty || moving || animated ? std::max(0, untilFrame) : Player::meterInterval;
+
+		SDL_Event e;
+		if (SDL_WaitEventTimeout(&e, timeout)) {
+			queue(e);
+			while (SDL_PollEvent(&e))
+				queue(e);
+		}
+
+		bool frameDue = (int)(SDL_GetTicks() - lastFrame) >= renderer.frameInterval;
+		bool moved = moving && frameDue;
+		if (moved) {
+			moving = false;
+			handle(motion);
+		}
+
+		if (Graph::dirty) {
+			GraphSnapshot* snapshot = Graph::compile(modules);
+			if (!engine.post(PatchCommand{ PatchCommand::SetGraph, snapshot })) {
+				delete snapshot;
+				Graph::invalidate();
 			}
 		}
+		engine.collect();
+
+		player.update();
+
+		// The back buffer is undefined after a present, so a frame is always drawn whole
+		if (!frameDue || !Drawable::dirty) {
+			// A slot that passed without drawing still ends, so polling an animated module or motion nothing
+			// reacted to waits a whole frame interval instead of spinning
+			if (frameDue)
+				lastFrame = SDL_GetTicks();
+			continue;
+		}
+		Drawable::dirty = false;
+
+		SDL_Rect background{ 0, 0, window->width, window->height };
+		renderer.fillRect(&background, SDL_Color{ 0, 0, 0 });
+
+		std::erase_if(modules, [](Module* m) { return m->queueDelete; });
+		std::erase_if(cables, [](Cable* c) { return c->queueDelete; });
 
-		SDL_RenderPresent(renderer.sdl);
+		for (int i = modules.size() - 1; i >= 0; i--)
+			modules[i]->draw(renderer);
+		for (int i = cables.size() - 1; i >= 0; i--)
+			cables[i]->draw(renderer);
+		moduleMenu.draw(renderer);
+
+		renderer.present();
+		lastFrame = SDL_GetTicks();
 	}
 
+	engine.meter.report(std::cout);
+
 	return 0;
 }
\ No newline at end of file
@@ -1,3 +1,3 @@
 #include "window.h"
 
-Window window("modsynth", 800, 600);
\ No newline at end of file
+Window* window = nullptr;
\ No newline at end of file
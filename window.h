@@ -1,3 +1,3 @@
 #include "Component.h"
 
-extern Window window;
\ No newline at end of file
+extern Window* window;
\ No newline at end of file